@@ -25,9 +25,15 @@
 #include "config.h"
 #include "musicmgr.h"
 #include "mpcomm.h"
+#include "mpintern.h"
 
 /* playlist lock, on some operations tha playlist must not change */
 static pthread_mutex_t pllock = PTHREAD_MUTEX_INITIALIZER;
+/* catalogue lock, titles of the live database are only added, removed,
+ * moved or renumbered while holding it. Jobs only hold it to apply their
+ * changes, not while they read files, and call into code that takes it
+ * again. Take it before the playlist lock! */
+static pthread_mutex_t catlock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 /* synchronize configuration access */
 static pthread_mutex_t conflock = PTHREAD_MUTEX_INITIALIZER;
 /* notification when the configuration is available */
@@ -38,6 +44,18 @@ static pthread_mutex_t _addmsglock = PTHREAD_MUTEX_INITIALIZER;
 /* callback lock */
 static pthread_mutex_t _cblock = PTHREAD_MUTEX_INITIALIZER;
 
+/* blocks of titles that have been allocated in one go */
+typedef struct titlearena_s titlearena_t;
+struct titlearena_s {
+	mptitle_t *titles;
+	uint32_t num;				/* number of titles in the block */
+	uint32_t used;				/* number of titles not yet freed */
+	titlearena_t *next;
+};
+
+static titlearena_t *_arenas = NULL;
+static pthread_mutex_t _arenalock = PTHREAD_MUTEX_INITIALIZER;
+
 static mpconfig_t *_cconfig = NULL;
 
 #define MPV 10
@@ -108,6 +126,18 @@ int32_t trylockPlaylist(void) {
 	return (pthread_mutex_trylock(&pllock) != EBUSY);
 }
 
+void lockCatalog(void) {
+	pthread_mutex_lock(&catlock);
+}
+
+void unlockCatalog(void) {
+	pthread_mutex_unlock(&catlock);
+}
+
+int32_t trylockCatalog(void) {
+	return (pthread_mutex_trylock(&catlock) != EBUSY);
+}
+
 void invokeHooks(_mpfunc * hooks) {
 	_mpfunc *pos = hooks;
 
@@ -335,6 +365,11 @@ mpconfig_t *readConfig(void) {
 	_cconfig->dbname = (char *) falloc(MAXPATHLEN + 1, 1);
 	_cconfig->password = strdup("mixplay");
 	_cconfig->skipdnp = 3;
+	_cconfig->scanworkers = 0;
+	_cconfig->scanfps = 0;
+	_cconfig->scanmbps = 0;
+	_cconfig->searchworkers = 0;
+	_cconfig->watch = false;
 	_cconfig->sleepto = 0;
 	_cconfig->debug = 0;
 	_cconfig->fade = FADESECS;
@@ -350,6 +385,7 @@ mpconfig_t *readConfig(void) {
 	_cconfig->lineout = 0;
 	_cconfig->linestream = VOLUME_STREAM;
 	_cconfig->process = 0;
+	_cconfig->throttle = 0;
 	_cconfig->stop = false;
 
 	snprintf(_cconfig->dbname, MAXPATHLEN, "%s/.mixplay/mixplay.db", home);
@@ -441,6 +477,21 @@ mpconfig_t *readConfig(void) {
 			if (strstr(line, "skipdnp=") == line) {
 				_cconfig->skipdnp = atoi(pos);
 			}
+			if (strstr(line, "scanworkers=") == line) {
+				_cconfig->scanworkers = atoi(pos);
+			}
+			if (strstr(line, "scanfps=") == line) {
+				_cconfig->scanfps = atoi(pos);
+			}
+			if (strstr(line, "scanmbps=") == line) {
+				_cconfig->scanmbps = atoi(pos);
+			}
+			if (strstr(line, "searchworkers=") == line) {
+				_cconfig->searchworkers = atoi(pos);
+			}
+			if (strstr(line, "watch=") == line) {
+				_cconfig->watch = (atoi(pos) != 0);
+			}
 			if (strstr(line, "sleepto=") == line) {
 				_cconfig->sleepto = atoi(pos);
 			}
@@ -578,6 +629,22 @@ void writeConfig(const char *musicpath) {
 		if (_cconfig->port != MP_PORT) {
 			fprintf(fp, "\nport=%i", _cconfig->port);
 		}
+		if (_cconfig->scanworkers != 0) {
+			fprintf(fp, "\nscanworkers=%" PRIu32, _cconfig->scanworkers);
+		}
+		if (_cconfig->scanfps != 0) {
+			fprintf(fp, "\nscanfps=%" PRIu32, _cconfig->scanfps);
+		}
+		if (_cconfig->scanmbps != 0) {
+			fprintf(fp, "\nscanmbps=%" PRIu32, _cconfig->scanmbps);
+		}
+		if (_cconfig->searchworkers != 0) {
+			fprintf(fp, "\nsearchworkers=%" PRIu32,
+					_cconfig->searchworkers);
+		}
+		if (_cconfig->watch) {
+			fprintf(fp, "\nwatch=1");
+		}
 		if (_cconfig->rcdev != NULL) {
 			fprintf(fp, "\nrcdev=%s", _cconfig->rcdev);
 			fprintf(fp, "\nrccodes=");
@@ -692,7 +759,7 @@ static mpplaylist_t *_wipePlaylist(mpplaylist_t * pl, bool recursive,
 			pl->title->flags &= ~MP_INPL;
 		}
 		if (recursive) {
-			free(pl->title);
+			freeTitle(pl->title);
 			pl->title = NULL;
 		}
 		pl->next = NULL;
@@ -770,6 +837,8 @@ void freeConfig() {
 	if (_cconfig->found->albart != NULL) {
 		free(_cconfig->found->albart);
 	}
+	hashWipe(_cconfig->found->artidx);
+	hashWipe(_cconfig->found->albidx);
 	free(_cconfig->found);
 	wipeList(_cconfig->dnplist);
 	wipeList(_cconfig->favlist);
@@ -1124,6 +1193,60 @@ marklist_t *wipeList(marklist_t * root) {
 	return NULL;
 }
 
+/**
+ * allocates num cleared titles in one contiguous block, so that walking
+ * a list that was built in order is a linear walk through memory.
+ * Each title must be released with freeTitle() and the block is freed
+ * with the last title.
+ */
+mptitle_t *allocTitles(uint32_t num) {
+	titlearena_t *arena;
+
+	if (num == 0) {
+		return NULL;
+	}
+
+	arena = (titlearena_t *) falloc(1, sizeof (titlearena_t));
+	arena->titles = (mptitle_t *) falloc(num, sizeof (mptitle_t));
+	arena->num = num;
+	arena->used = num;
+
+	pthread_mutex_lock(&_arenalock);
+	arena->next = _arenas;
+	_arenas = arena;
+	pthread_mutex_unlock(&_arenalock);
+
+	return arena->titles;
+}
+
+/**
+ * frees a title, either directly or by releasing it from it's block
+ */
+void freeTitle(mptitle_t * title) {
+	titlearena_t *arena;
+	titlearena_t **prev;
+
+	internFree(title);
+	pthread_mutex_lock(&_arenalock);
+	prev = &_arenas;
+	for (arena = _arenas; arena != NULL; arena = arena->next) {
+		if ((title >= arena->titles) && (title < arena->titles + arena->num)) {
+			arena->used--;
+			if (arena->used == 0) {
+				*prev = arena->next;
+				free(arena->titles);
+				free(arena);
+			}
+			pthread_mutex_unlock(&_arenalock);
+			return;
+		}
+		prev = &(arena->next);
+	}
+	pthread_mutex_unlock(&_arenalock);
+
+	free(title);
+}
+
 /**
  * discards a list of titles and frees the memory
  * returns NULL for intuitive calling
@@ -1137,7 +1260,7 @@ mptitle_t *wipeTitles(mptitle_t * root) {
 		activity(2, "Cleaning");
 		while (runner != NULL) {
 			root = runner->next;
-			free(runner);
+			freeTitle(runner);
 			runner = root;
 		}
 	}
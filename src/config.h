@@ -77,6 +77,7 @@ typedef enum {
 	mpc_display = 1 << 12,		/* 0x1000 */
 	mpc_substr = 1 << 13,		/* 0x2000 */
 	mpc_recent = 1 << 14,		/* 0x4000 - experimental newest with empty term */
+	mpc_page = 1 << 15,			/* 0x8000 - search arg is cursor/term */
 } mpcmd_t;
 
 /* some filtermasks */
@@ -100,7 +101,7 @@ extern const char *_mprccmdstrings[MPRC_NUM];
 
 /*
  * qualifiers for mpc_dnp, mpc_fav and mpc_search
- * 0FSR RRRR 000C CCCC
+ * PFSR RRRR 000C CCCC
  */
 /* extract raw command */
 #define MPC_CMD(x)   (mpcmd_t)((int32_t)x&0x00ff)
@@ -123,6 +124,8 @@ extern const char *_mprccmdstrings[MPRC_NUM];
 #define MPC_ISSUBSTR(x) (x & mpc_substr )
 /* is this a real search */
 #define MPC_ISRECENT(x) (x & mpc_recent )
+/* is this the next page of a search */
+#define MPC_ISPAGE(x) (x & mpc_page )
 
 /* playmodes */
 #define PM_NONE     0x00
@@ -166,6 +169,11 @@ typedef struct {
 	pthread_t rtid;				/* thread ID of the reader */
 	pthread_t stid;				/* thread ID of the server */
 	uint32_t skipdnp;			/* how many skips mean dnp? */
+	uint32_t scanworkers;		/* parallel tag readers, 0 = one per CPU */
+	uint32_t scanfps;			/* files per second on a rescan, 0 = no limit */
+	uint32_t scanmbps;			/* MB per second on a rescan, 0 = no limit */
+	uint32_t searchworkers;		/* parallel search threads, 0 = one per CPU */
+	bool watch;					/* follow changes in the musicdir */
 	int32_t volume;				/* current volume [0..100] */
 	char *channel;				/* the name of the ALSA master channel */
 	uint32_t debug;
@@ -190,6 +198,7 @@ typedef struct {
 	uint32_t tnum;				/* number of titles in the current profile */
 	bool canUpload;
 	uint32_t process;
+	uint32_t throttle;			/* state of the background jobs */
 	bool stop;					/* don't play on start */
 } mpconfig_t;
 
@@ -258,6 +267,8 @@ char *fullpath(const char *file);
 void wipePlaylist(mpconfig_t *);
 void wipeSearchList(mpconfig_t *);
 
+mptitle_t *allocTitles(uint32_t num);
+void freeTitle(mptitle_t * title);
 mptitle_t *wipeTitles(mptitle_t * root);
 marklist_t *wipeList(marklist_t * root);
 bool playerIsBusy(void);
@@ -275,5 +286,8 @@ void initMsgCnt(int32_t);
 int32_t trylockPlaylist(void);
 void lockPlaylist(void);
 void unlockPlaylist(void);
+int32_t trylockCatalog(void);
+void lockCatalog(void);
+void unlockCatalog(void);
 
 #endif /* _CONFIG_H_ */
@@ -18,6 +18,7 @@
 #include "config.h"
 #include "mpinit.h"
 #include "mpcomm.h"
+#include "mpthrottle.h"
 
 #define MPV 10
 
@@ -116,7 +117,7 @@ static mptitle_t *getCurrentTitle() {
 /**
  * to be called after removing titles, marking them DNP or as DBL.
  **/
-static void checkAfterRemove(mptitle_t * ctitle) {
+void checkAfterRemove(mptitle_t * ctitle) {
 	/* clean up the playlist without adding new titles */
 	plCheck(false);
 	/* has the current title changed? Then send a replay to play the new
@@ -134,7 +135,9 @@ static void checkAfterRemove(mptitle_t * ctitle) {
 
 /**
  * asnchronous functions to run in the background and allow updates being sent to the
- * client
+ * client. Jobs that change the database hold the catalogue lock, but not
+ * while they read files, dbAddTitles() and dbCheckExist() lock it on
+ * their own.
  */
 static void *plCheckDoublets(void *cidin) {
 	int32_t cid = (int32_t)(long)cidin;
@@ -142,6 +145,8 @@ static void *plCheckDoublets(void *cidin) {
 	mptitle_t *ctitle = getCurrentTitle();
 
 	lockClient(cid);
+	throttleStart();
+	lockCatalog();
 	addMessage(0, "Checking for doublets..");
 	/* update database with current playcount etc */
 	dbWrite(0);
@@ -156,6 +161,8 @@ static void *plCheckDoublets(void *cidin) {
 		addMessage(0, "No doublets found");
 	}
 	setTnum();
+	unlockCatalog();
+	throttleEnd();
 	unlockClient(cid);
 	return NULL;
 }
@@ -168,35 +175,36 @@ static void *plDbClean(void *cidin) {
 	int32_t changed = 0;
 
 	lockClient(cid);
+	throttleStart();
 	addMessage(0, "Database Cleanup");
 
-	/* update database with current playcount etc */
-	dbWrite(0);
-
-	addMessage(0, "Checking for deleted titles..");
-	i = dbCheckExist();
+	/* new titles first, so moved titles keep their counts */
+	addMessage(0, "Checking for new titles..");
+	i = dbAddTitles(control->musicdir);
 
 	if (i > 0) {
-		addMessage(0, "Removed %i titles", i);
-		changed = 1;
+		addMessage(0, "Added %i new titles", i);
+		changed = 2;
 	}
 	else {
-		addMessage(0, "No titles removed");
+		addMessage(0, "No titles to be added");
 	}
 
-	addMessage(0, "Checking for new titles..");
-	i = dbAddTitles(control->musicdir);
+	addMessage(0, "Checking for deleted titles..");
+	i = dbCheckExist();
 
 	if (i > 0) {
-		addMessage(0, "Added %i new titles", i);
-		changed |= 2;
+		addMessage(0, "Removed %i titles", i);
+		changed |= 1;
 	}
 	else {
-		addMessage(0, "No titles to be added");
+		addMessage(0, "No titles removed");
 	}
 
+	lockCatalog();
+	/* one write for the changes and the current playcounts */
+	dbWrite(changed ? 1 : 0);
 	if (changed) {
-		dbWrite(1);
 		setArtistSpread();
 		if (changed & 1) {
 			checkAfterRemove(ctitle);
@@ -204,6 +212,8 @@ static void *plDbClean(void *cidin) {
 	}
 
 	setTnum();
+	unlockCatalog();
+	throttleEnd();
 	unlockClient(cid);
 	return NULL;
 }
@@ -211,9 +221,13 @@ static void *plDbClean(void *cidin) {
 static void *plDbFix(void *cidin) {
 	int32_t cid = (int32_t)(long)cidin;
 	lockClient(cid);
+	throttleStart();
+	lockCatalog();
 	addMessage(0, "Database smooth");
 	dumpInfo(true);
 	setTnum();
+	unlockCatalog();
+	throttleEnd();
 	unlockClient(cid);
 	return NULL;
 }
@@ -617,7 +631,24 @@ void setCommand(mpcmd_t rcmd, char *arg, int32_t cid) {
 		 * again, unlocking the player */
 	case mpc_search:
 		{
-			char *term = arg;
+			const char *term = arg;
+			char *cursor = NULL;
+			char *sep;
+			mpcmd_t mode = MPC_MODE(rcmd) & ~mpc_page;
+
+			/* the next page comes as cursor/term */
+			if (MPC_ISPAGE(rcmd) && (arg != NULL)) {
+				cursor = arg;
+				sep = strchr(arg, '/');
+				term = sep;
+				if (sep != NULL) {
+					*sep = 0;
+					term = sep + 1;
+					if (*term == 0) {
+						term = NULL;
+					}
+				}
+			}
 
 			/* if the term is unset but the fuzzy bit is set, return the last ten
 			 * titles in the database */
@@ -635,7 +666,10 @@ void setCommand(mpcmd_t rcmd, char *arg, int32_t cid) {
 			}
 			else {
 				lockClient(cid);
-				if (search(MPC_MODE(rcmd), term, cid) == -1) {
+				/* a client that asks for the next page knows there are
+				 * more results */
+				if ((search(mode, term, cursor, cid) == -1) &&
+					(cursor == NULL)) {
 					addMessage(0, "Too many entries found!");
 				}
 				unlockClient(cid);
@@ -3,5 +3,6 @@
 #include "config.h"
 
 void setCommand(mpcmd_t cmd, char *arg, int32_t cid);
+void checkAfterRemove(mptitle_t * ctitle);
 
 #endif
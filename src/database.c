@@ -4,13 +4,103 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#include <dirent.h>
 
 #include "database.h"
 #include "utils.h"
 #include "mpgutils.h"
+#include "mphash.h"
+#include "mpintern.h"
+#include "mpthrottle.h"
+#include "mptrigram.h"
+
+/* titles of the live database, indexed by their key */
+static mptitle_t **_keyidx = NULL;
+static uint32_t _keylen = 0;
+/* titles of the live database, hashed by path and by filename */
+static mphash_t *_pathidx = NULL;
+static mphash_t *_nameidx = NULL;
+/* titles of the live database by the trigrams of their search keys */
+static mptrigram_t *_trgidx = NULL;
+/* the root the indices were built for */
+static mptitle_t *_idxroot = NULL;
+/* changes whenever titles of the live database come, go or change */
+static uint32_t _dbgen = 0;
+/* the indices only change with the catalogue locked, lookups from other
+ * threads need this too. Titles of the live database are also only
+ * linked, unlinked and freed with the write lock held, so readers like
+ * search() can walk the titles without the catalogue lock */
+static pthread_rwlock_t _idxlock = PTHREAD_RWLOCK_INITIALIZER;
+/* counts the databases that went live, a job that works without the
+ * catalogue lock drops its results if the database was replaced */
+static uint32_t _dbload = 0;
+
+/* directory tree of the live database, each directory knows its titles */
+typedef struct mpdir_s mpdir_t;
+struct mpdir_s {
+	char *path;					/* full path without trailing slash */
+	mpdir_t *child;				/* first subdirectory */
+	mpdir_t *sibling;			/* next directory with the same parent */
+	mptitle_t **titles;			/* titles directly in this directory */
+	uint32_t num;
+};
+
+static mphash_t *_diridx = NULL;
+static mpdir_t **_dirs = NULL;
+static uint32_t _dirnum = 0;
+
+/* the mapped database file */
+static uint8_t *_dbmap = NULL;
+static size_t _dbmapsize = 0;
+static uint32_t _dbmapnum = 0;
+static uint32_t _dbmapver = 0;
+/* the mapping must not change while records are updated */
+static pthread_mutex_t _dbmaplock = PTHREAD_MUTEX_INITIALIZER;
+
+/* journal of count changes that are not yet synced into the database */
+static int32_t _dbjrn = -1;
+static uint32_t _jrnnum = 0;
+static bool _compacting = false;
+
+/* compact the journal after this many changes */
+#define JRNMAX 256
+
+/* a snapshot of the database that is waiting to be stored */
+typedef struct {
+	uint8_t *buff;				/* the encoded database */
+	size_t size;
+	uint32_t jrnpos;			/* journal entries at the time of the snapshot */
+} dbsnap_t;
+
+/* database writer thread, only one snapshot is kept in the queue */
+static dbsnap_t *_dbwqueue = NULL;
+static bool _dbwbusy = false;
+static bool _dbwrunning = false;
+static uint32_t _dbsnaps = 0;	/* snapshots not yet stored, uses _dbmaplock */
+static pthread_mutex_t _dbwlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _dbwcond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t _dbwdone = PTHREAD_COND_INITIALIZER;
+
+static void dbFlush(int32_t force, bool wait);
+
+/* number of parallel directory checks on cleanup */
+#define DBCHECKWORKERS 8
+
+/* unchanged files of the running scan and how many of them had no
+ * file state yet */
+static uint32_t _dbknown = 0;
+static uint32_t _dbadopted = 0;
+/* bitmap of the keys of the unchanged titles, only set while scanning */
+static uint32_t *_dbseen = NULL;
+static uint32_t _dbseenlen = 0;
+/* only one scan at a time, take it before the catalogue lock! */
+static pthread_mutex_t _scanlock = PTHREAD_MUTEX_INITIALIZER;
 
 /**
  * closes the database file
@@ -30,104 +120,992 @@ void dbMarkDirty(void) {
 		return;
 	}
 
-	if (getConfig()->dbDirty++ > 25) {
-		dbWrite(0);
+	/* the write happens in the background. A job that holds the catalogue
+	 * writes the database when it is done */
+	if ((getConfig()->dbDirty++ > 25) && trylockCatalog()) {
+		dbFlush(0, false);
+		unlockCatalog();
 	}
 }
 
-mptitle_t *getTitleByIndex(uint32_t index) {
-	mptitle_t *root = getConfig()->root;
-	mptitle_t *run = root;
+/**
+ * drops the current database mapping
+ */
+static void dbUnmap(void) {
+	if (_dbmap != NULL) {
+		munmap(_dbmap, _dbmapsize);
+	}
+	_dbmap = NULL;
+	_dbmapsize = 0;
+	_dbmapnum = 0;
+	_dbmapver = 0;
+}
 
-	if ((root == NULL) || (index == 0)) {
-		return NULL;
+/**
+ * maps the open database file into memory and checks the format
+ * returns the number of records or -1 if the file is corrupt
+ */
+static int32_t dbMap(int32_t db) {
+	struct stat st;
+	dbheader_t *head;
+	void *map;
+
+	pthread_mutex_lock(&_dbmaplock);
+	dbUnmap();
+
+	if (fstat(db, &st) == -1) {
+		pthread_mutex_unlock(&_dbmaplock);
+		return -1;
 	}
 
-	do {
-		if (run->key == index) {
-			return run;
+	/* an empty database cannot be mapped */
+	if (st.st_size == 0) {
+		pthread_mutex_unlock(&_dbmaplock);
+		return 0;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, db, 0);
+	if (map == MAP_FAILED) {
+		addMessage(0, "Could not map database: %s", strerror(errno));
+		pthread_mutex_unlock(&_dbmaplock);
+		return -1;
+	}
+	_dbmap = (uint8_t *) map;
+	_dbmapsize = st.st_size;
+
+	head = (dbheader_t *) _dbmap;
+	if ((_dbmapsize >= DBHSIZE) && !memcmp(head->magic, DBMAGIC, 4)) {
+		if (((head->version == DBVERSION) || (head->version == 2)) &&
+			(head->size == _dbmapsize) &&
+			(DBHSIZE + (size_t) head->count * 4 <= _dbmapsize)) {
+			_dbmapver = head->version;
+			_dbmapnum = head->count;
 		}
-		run = run->next;
-	} while (root != run);
+	}
+	/* fixed size records of the original format */
+	else if (_dbmapsize % DBESIZE == 0) {
+		_dbmapver = 1;
+		_dbmapnum = _dbmapsize / DBESIZE;
+	}
 
-	return NULL;
+	if (_dbmapver == 0) {
+		dbUnmap();
+		pthread_mutex_unlock(&_dbmaplock);
+		return -1;
+	}
+
+	pthread_mutex_unlock(&_dbmaplock);
+	return _dbmapnum;
 }
 
 /**
- * searches for a title that fits the name in the range.
- * This is kind of a hack to turn an artist name or an album name into
- * a title that can be used for FAV/DNP marking.
+ * returns the size of the fixed part of a record in the mapped format
  */
-mptitle_t *getTitleForRange(const mpcmd_t range, const char *name) {
-	/* start with the current title so we can notice it disappear on DNP */
-	mptitle_t *root = getConfig()->current->title;
-	mptitle_t *run = root;
+static size_t dbRecordHead(void) {
+	return (_dbmapver == 2) ? DBR2SIZE : DBRSIZE;
+}
 
-	if (root == NULL) {
+/**
+ * returns the strings of a mapped record
+ */
+static uint8_t *dbRecordData(dbrecord_t * record) {
+	return (uint8_t *) record + dbRecordHead();
+}
+
+/**
+ * returns the mapped record for the given key or NULL if the record is
+ * not valid. Does not work on the original format!
+ */
+static dbrecord_t *dbRecord(uint32_t key) {
+	uint32_t *offsets = (uint32_t *) (_dbmap + DBHSIZE);
+	uint32_t align = (_dbmapver == 2) ? 4 : 8;
+	uint32_t offset;
+
+	if ((_dbmapver < 2) || (key == 0) || (key > _dbmapnum)) {
 		return NULL;
 	}
 
-	if (!MPC_EQALBUM(range) && !MPC_EQARTIST(range)) {
-		addMessage(0,
-				   "Can only search represantatives for Artists and Albums!");
+	offset = offsets[key - 1];
+	if ((offset % align) || (offset < DBHSIZE + _dbmapnum * 4) ||
+		(offset + dbRecordHead() + 2 > _dbmapsize)) {
 		return NULL;
 	}
 
-	do {
-		if (MPC_EQALBUM(range) && !strcasecmp(run->album, name)) {
-			return run;
-		}
-		if (MPC_EQARTIST(range) && !strcasecmp(run->artist, name)) {
-			return run;
+	return (dbrecord_t *) (_dbmap + offset);
+}
+
+/**
+ * reads a length prefixed string at pos into target and returns the
+ * position behind the string or NULL if the string exceeds the mapping.
+ * The string will be truncated to len-1 characters.
+ */
+static const uint8_t *dbGetString(const uint8_t * pos, char *target,
+								  size_t len) {
+	const uint8_t *end = _dbmap + _dbmapsize;
+	size_t slen;
+
+	if (pos + 2 > end) {
+		return NULL;
+	}
+	slen = pos[0] | (pos[1] << 8);
+	pos += 2;
+	if (pos + slen > end) {
+		return NULL;
+	}
+
+	len = MIN(slen, len - 1);
+	memcpy(target, pos, len);
+	target[len] = 0;
+
+	return pos + slen;
+}
+
+/**
+ * stores text as a length prefixed string at pos and returns the position
+ * behind the string
+ */
+static uint8_t *dbPutString(uint8_t * pos, const char *text) {
+	size_t len = strlen(text);
+
+	pos[0] = len & 0xff;
+	pos[1] = (len >> 8) & 0xff;
+	memcpy(pos + 2, text, len);
+	return pos + 2 + len;
+}
+
+/**
+ * reads the mapped record with the given key into a database entry
+ * returns -1 if the record is broken
+ */
+static int32_t dbGetEntry(uint32_t key, dbentry_t * dbentry) {
+	dbrecord_t *record;
+	const uint8_t *pos;
+
+	if (_dbmapver == 1) {
+		memcpy(dbentry, _dbmap + (key - 1) * DBESIZE, DBESIZE);
+		return 0;
+	}
+
+	record = dbRecord(key);
+	if (record == NULL) {
+		return -1;
+	}
+
+	memset(dbentry, 0, DBESIZE);
+	pos = dbRecordData(record);
+	if (((pos = dbGetString(pos, dbentry->path, MAXPATHLEN)) == NULL) ||
+		((pos = dbGetString(pos, dbentry->artist, NAMELEN)) == NULL) ||
+		((pos = dbGetString(pos, dbentry->title, NAMELEN)) == NULL) ||
+		((pos = dbGetString(pos, dbentry->album, NAMELEN)) == NULL) ||
+		((pos = dbGetString(pos, dbentry->genre, NAMELEN)) == NULL)) {
+		return -1;
+	}
+	dbentry->playcount = record->playcount;
+	dbentry->skipcount = record->skipcount;
+
+	return 0;
+}
+
+/**
+ * reads the file state of the mapped record with the given key into the
+ * title. Older formats do not know the file state.
+ */
+static void dbGetStat(uint32_t key, mptitle_t * title) {
+	dbrecord_t *record;
+
+	if (_dbmapver != DBVERSION) {
+		return;
+	}
+
+	record = dbRecord(key);
+	if (record != NULL) {
+		title->size = record->size;
+		title->mtime = record->mtime;
+		title->inode = record->inode;
+	}
+}
+
+/**
+ * returns the mapped record of the given title if the record still
+ * belongs to the title
+ */
+static dbrecord_t *dbTitleRecord(const mptitle_t * title) {
+	dbrecord_t *record = dbRecord(title->key);
+	uint8_t *data;
+	size_t len;
+
+	if (record == NULL) {
+		return NULL;
+	}
+
+	data = dbRecordData(record);
+	len = data[0] | (data[1] << 8);
+	if ((len != strlen(title->path)) ||
+		(data + 2 + len > _dbmap + _dbmapsize) ||
+		memcmp(data + 2, title->path, len)) {
+		return NULL;
+	}
+
+	return record;
+}
+
+/**
+ * returns the path to the journal file
+ */
+static void dbJournalPath(char path[MAXPATHLEN + 1]) {
+	strtcpy(path, getConfig()->dbname, MAXPATHLEN);
+	strtcat(path, ".jrn", MAXPATHLEN);
+}
+
+/**
+ * appends the counts of the title to the journal and syncs it
+ */
+static void dbJournalAdd(mptitle_t * title) {
+	dbjournal_t entry;
+	char path[MAXPATHLEN + 1];
+
+	if (_dbjrn == -1) {
+		dbJournalPath(path);
+		_dbjrn = open(path, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR);
+		if (_dbjrn == -1) {
+			addMessage(0, "Could not open journal %s", path);
+			return;
 		}
-		run = run->next;
-	} while (root != run);
+	}
 
-	return NULL;
+	entry.key = title->key;
+	entry.hash = strhash(title->path);
+	entry.playcount = title->playcount;
+	entry.skipcount = title->skipcount;
+
+	if ((dowrite(_dbjrn, (char *) &entry, JRNESIZE) == -1) ||
+		(fdatasync(_dbjrn) == -1)) {
+		addMessage(0, "Could not write journal: %s", strerror(errno));
+	}
+	_jrnnum++;
 }
 
-/* compares two strings backwards.
-   returns 0 on inequality
-           1 on equality
-   used to compare paths since the difference is more likely to be at the end
-   so the difference will we noted faster and with more than 5k titles things
-   like these start to matter */
-static int32_t strreq(const char *str1, const char *str2) {
-	size_t len = strlen(str1);
+/**
+ * empties the journal, must only be called when all changes in the
+ * journal are safely stored in the database file.
+ */
+static void dbJournalClear(void) {
+	char path[MAXPATHLEN + 1];
 
-	if (strlen(str2) != len) {
+	dbJournalPath(path);
+	if ((truncate(path, 0) == -1) && (errno != ENOENT)) {
+		addMessage(0, "Could not clear journal: %s", strerror(errno));
+	}
+	_jrnnum = 0;
+}
+
+/**
+ * syncs the mapped database with the file and clears the journal.
+ * must be called with the _dbmaplock held!
+ */
+static void dbJournalSync(void) {
+	if ((_dbmap != NULL) && (msync(_dbmap, _dbmapsize, MS_SYNC) == -1)) {
+		addMessage(0, "Could not sync database: %s", strerror(errno));
+		return;
+	}
+	dbJournalClear();
+}
+
+/**
+ * background thread to merge the journal into the database
+ */
+static void *dbJournalCompact(void *arg) {
+	(void) arg;
+
+	pthread_mutex_lock(&_dbmaplock);
+	/* the writer needs the journal to catch up with the snapshot */
+	if (_dbsnaps == 0) {
+		addMessage(2, "Compacting %" PRIu32 " journal entries", _jrnnum);
+		dbJournalSync();
+	}
+	_compacting = false;
+	pthread_mutex_unlock(&_dbmaplock);
+	return NULL;
+}
+
+/**
+ * applies the journal to freshly loaded titles and their records.
+ * must be called with the _dbmaplock held!
+ * returns the number of applied entries
+ */
+static uint32_t dbJournalReplay(mptitle_t * titles, uint32_t num) {
+	dbjournal_t entries[64];
+	char path[MAXPATHLEN + 1];
+	uint32_t cnt = 0;
+	ssize_t len;
+	int32_t fd;
+
+	dbJournalPath(path);
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
 		return 0;
 	}
 
-	do {
-		if (str1[len] != str2[len]) {
-			return 0;
+	/* a truncated last entry is just ignored */
+	while ((len = read(fd, entries, sizeof (entries))) >= (ssize_t) JRNESIZE) {
+		for (uint32_t i = 0; i < len / JRNESIZE; i++) {
+			uint32_t key = entries[i].key;
+			dbrecord_t *record;
+
+			if ((key == 0) || (key > num) ||
+				(strhash(titles[key - 1].path) != entries[i].hash)) {
+				continue;
+			}
+			titles[key - 1].playcount = entries[i].playcount;
+			titles[key - 1].favpcount = entries[i].playcount;
+			titles[key - 1].skipcount = entries[i].skipcount;
+			record = dbTitleRecord(&titles[key - 1]);
+			if (record != NULL) {
+				record->playcount = entries[i].playcount;
+				record->skipcount = entries[i].skipcount;
+			}
+			cnt++;
 		}
-	} while (--len != 0);
+	}
+	close(fd);
 
-	return 1;
+	return cnt;
 }
 
 /**
- * 	searches for a given path in the mixplay entry list
+ * writes the play- and skipcount of a title into the journal and directly
+ * into its record in the mapped database. If the title has no record yet,
+ * the database is just marked dirty.
  */
-static mptitle_t *findTitle(mptitle_t * base, const char *path) {
-	mptitle_t *runner;
+void dbUpdateCount(mptitle_t * title) {
+	dbrecord_t *record;
+	pthread_t tid;
+
+	if (!(getConfig()->mpmode & PM_DATABASE) || getFavplay()) {
+		return;
+	}
+
+	pthread_mutex_lock(&_dbmaplock);
+	record = dbTitleRecord(title);
+	if (record == NULL) {
+		pthread_mutex_unlock(&_dbmaplock);
+		dbMarkDirty();
+		return;
+	}
+
+	dbJournalAdd(title);
+	record->playcount = title->playcount;
+	record->skipcount = title->skipcount;
+
+	if ((_jrnnum > JRNMAX) && !_compacting) {
+		if (pthread_create(&tid, NULL, dbJournalCompact, NULL) == 0) {
+			_compacting = true;
+			pthread_setname_np(tid, "dbcompact");
+			pthread_detach(tid);
+		}
+	}
+	pthread_mutex_unlock(&_dbmaplock);
+}
 
-	if (NULL == base) {
+/**
+ * returns the filename part of a path
+ */
+static const char *fname(const char *path) {
+	const char *pos = strrchr(path, '/');
+
+	return (pos == NULL) ? path : pos + 1;
+}
+
+/**
+ * returns the directory node for the given path or NULL if there are no
+ * titles below that directory
+ */
+static mpdir_t *dbDirFind(const char *path) {
+	mphashentry_t *entry;
+
+	if (_diridx == NULL) {
 		return NULL;
 	}
 
-	runner = base;
+	for (entry = hashFirst(_diridx, strhash(path)); entry != NULL;
+		 entry = hashNext(entry)) {
+		if (strcmp(((mpdir_t *) entry->data)->path, path) == 0) {
+			return (mpdir_t *) entry->data;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * returns the node of the directory containing the title's file, the
+ * node and all missing parents are created if needed
+ */
+static mpdir_t *dbDirGet(const char *path) {
+	char dir[MAXPATHLEN];
+	char *pos;
+	mpdir_t *node;
+	mpdir_t *parent;
+
+	strtcpy(dir, path, MAXPATHLEN);
+	pos = strrchr(dir, '/');
+	if (pos == NULL) {
+		dir[0] = 0;
+	}
+	else {
+		*pos = 0;
+	}
+
+	node = dbDirFind(dir);
+	if (node != NULL) {
+		return node;
+	}
+
+	node = (mpdir_t *) falloc(1, sizeof (mpdir_t));
+	node->path = strdup(dir);
+	_dirs = (mpdir_t **) frealloc(_dirs, (_dirnum + 1) * sizeof (mpdir_t *));
+	_dirs[_dirnum++] = node;
+	hashAdd(_diridx, strhash(dir), node);
+
+	/* the root directory has no parent */
+	if (dir[0] != 0) {
+		parent = dbDirGet(dir);
+		node->sibling = parent->child;
+		parent->child = node;
+	}
+
+	return node;
+}
+
+/**
+ * adds a title to the node of its directory
+ */
+static void dbDirPut(mptitle_t * title) {
+	mpdir_t *node = dbDirGet(title->path);
+
+	/* grow in powers of two */
+	if ((node->num & (node->num - 1)) == 0) {
+		node->titles = (mptitle_t **) frealloc(node->titles,
+											   (node->num ? node->num * 2 : 1)
+											   * sizeof (mptitle_t *));
+	}
+	node->titles[node->num++] = title;
+}
+
+/**
+ * removes a title from the node of its directory
+ */
+static void dbDirDel(mptitle_t * title) {
+	char dir[MAXPATHLEN];
+	char *pos;
+	mpdir_t *node;
+
+	strtcpy(dir, title->path, MAXPATHLEN);
+	pos = strrchr(dir, '/');
+	if (pos == NULL) {
+		dir[0] = 0;
+	}
+	else {
+		*pos = 0;
+	}
+
+	node = dbDirFind(dir);
+	if (node == NULL) {
+		return;
+	}
+
+	for (uint32_t i = 0; i < node->num; i++) {
+		if (node->titles[i] == title) {
+			node->titles[i] = node->titles[--node->num];
+			return;
+		}
+	}
+}
+
+/**
+ * drops the directory tree
+ */
+static void dbDirClear(void) {
+	for (uint32_t i = 0; i < _dirnum; i++) {
+		free(_dirs[i]->path);
+		free(_dirs[i]->titles);
+		free(_dirs[i]);
+	}
+	free(_dirs);
+	_dirs = NULL;
+	_dirnum = 0;
+	_diridx = hashWipe(_diridx);
+}
+
+/**
+ * drops the indices
+ * must be called with _idxlock held for writing!
+ */
+static void dbIndexClear(void) {
+	free(_keyidx);
+	_keyidx = NULL;
+	_keylen = 0;
+	_pathidx = hashWipe(_pathidx);
+	_nameidx = hashWipe(_nameidx);
+	_trgidx = trigramWipe(_trgidx);
+	dbDirClear();
+	_idxroot = NULL;
+	_dbgen++;
+}
+
+/**
+ * puts a title into the key index, the index grows as needed
+ */
+static void dbIndexKey(mptitle_t * title) {
+	uint32_t len = _keylen;
+
+	if (title->key == 0) {
+		return;
+	}
+
+	if (title->key >= _keylen) {
+		/* grow in steps to avoid a realloc for every new title */
+		_keylen = title->key + 1024;
+		_keyidx =
+			(mptitle_t **) frealloc(_keyidx, _keylen * sizeof (mptitle_t *));
+		memset(_keyidx + len, 0, (_keylen - len) * sizeof (mptitle_t *));
+	}
+	_keyidx[title->key] = title;
+}
+
+/**
+ * puts the search keys of a title into the trigram index
+ */
+static void dbIndexSearch(mptitle_t * title) {
+	trigramAdd(_trgidx, title->key, title->lotitle);
+	trigramAdd(_trgidx, title->key, title->lodisplay);
+	trigramAdd(_trgidx, title->key, title->loartist);
+	trigramAdd(_trgidx, title->key, title->loalbum);
+}
+
+/**
+ * puts a title into all indices
+ * must be called with _idxlock held for writing!
+ */
+static void dbIndexPut(mptitle_t * title) {
+	dbIndexKey(title);
+	hashAdd(_pathidx, strhash(title->path), title);
+	hashAdd(_nameidx, strihash(fname(title->path)), title);
+	dbDirPut(title);
+	dbIndexSearch(title);
+	_dbgen++;
+}
+
+/**
+ * removes a title from the indices
+ * must be called with _idxlock held for writing!
+ */
+static void dbIndexDel(mptitle_t * title) {
+	if ((title->key < _keylen) && (_keyidx[title->key] == title)) {
+		_keyidx[title->key] = NULL;
+	}
+	if (_pathidx != NULL) {
+		hashDel(_pathidx, strhash(title->path), title);
+		hashDel(_nameidx, strihash(fname(title->path)), title);
+		dbDirDel(title);
+	}
+	_dbgen++;
+}
+
+/**
+ * (re)builds the indices for the given database
+ * must be called with _idxlock held for writing!
+ */
+static void dbIndexBuild(mptitle_t * root) {
+	mptitle_t *run = root;
+	uint32_t num = 0;
+
+	dbIndexClear();
+	if (root == NULL) {
+		return;
+	}
+
+	_idxroot = root;
+	num = root->prev->key;
+	_pathidx = hashInit(num);
+	_nameidx = hashInit(num);
+	_diridx = hashInit(num / 8);
+	_trgidx = trigramInit(num / 4);
 
 	do {
-		if (strreq(runner->path, path)) {
-			return runner;
+		dbIndexPut(run);
+		run = run->next;
+	} while (run != root);
+}
+
+/**
+ * follows the new keys of the titles after the database has been written
+ * must be called with _idxlock held for writing!
+ */
+static void dbIndexRekey(mptitle_t * root) {
+	mptitle_t *runner = root;
+	uint32_t *map;
+	bool moved = false;
+
+	/* the trigram index knows the titles by the old keys */
+	map = (uint32_t *) falloc(_keylen, sizeof (uint32_t));
+	for (uint32_t i = 0; i < _keylen; i++) {
+		if (_keyidx[i] != NULL) {
+			map[i] = _keyidx[i]->key;
+			moved = moved || (map[i] != i);
 		}
+	}
+	if (moved) {
+		trigramRemap(_trgidx, map, _keylen);
+	}
+	free(map);
 
+	memset(_keyidx, 0, _keylen * sizeof (mptitle_t *));
+	do {
+		dbIndexKey(runner);
 		runner = runner->next;
+	} while (runner != root);
+}
+
+/**
+ * makes root the live database and builds its indices, so lookups never
+ * need to build them.
+ * must be called with the catalogue locked!
+ */
+void dbSetRoot(mptitle_t * root) {
+	pthread_rwlock_wrlock(&_idxlock);
+	getConfig()->root = root;
+	dbIndexBuild(root);
+	_dbload++;
+	pthread_rwlock_unlock(&_idxlock);
+}
+
+/**
+ * adds a new title of the live database to the indices
+ * titles of a database that is not live yet are indexed by dbSetRoot()
+ */
+void dbIndexTitle(mptitle_t * title) {
+	pthread_rwlock_wrlock(&_idxlock);
+	if ((_pathidx != NULL) && (_idxroot == getConfig()->root)) {
+		dbIndexPut(title);
+	}
+	pthread_rwlock_unlock(&_idxlock);
+}
+
+/**
+ * appends a new title to the live database, it gets the next free key.
+ * must be called with the catalogue locked!
+ */
+void dbAppendTitle(mptitle_t * title) {
+	mptitle_t *tail = getConfig()->root->prev;
+
+	pthread_rwlock_wrlock(&_idxlock);
+	title->key = tail->key + 1;
+	title->next = tail->next;
+	title->prev = tail;
+	tail->next = title;
+	title->next->prev = title;
+	if ((_pathidx != NULL) && (_idxroot == getConfig()->root)) {
+		dbIndexPut(title);
+	}
+	pthread_rwlock_unlock(&_idxlock);
+}
+
+/**
+ * returns the generation of the live database. It changes whenever a
+ * title is added, removed or changed, so anything derived from the
+ * titles is outdated when the generation changed.
+ */
+uint32_t dbGeneration(void) {
+	return _dbgen;
+}
+
+/**
+ * keeps the titles of the live database from being added, removed or
+ * freed, so a reader can walk them without the catalogue lock. Other
+ * lookups may be called meanwhile, but nothing that changes the titles.
+ */
+void dbLockTitles(void) {
+	pthread_rwlock_rdlock(&_idxlock);
+}
+
+void dbUnlockTitles(void) {
+	pthread_rwlock_unlock(&_idxlock);
+}
+
+mptitle_t *getTitleByIndex(uint32_t index) {
+	mptitle_t *title = NULL;
+
+	if ((getConfig()->root == NULL) || (index == 0)) {
+		return NULL;
+	}
+
+	pthread_rwlock_rdlock(&_idxlock);
+	if (index < _keylen) {
+		title = _keyidx[index];
+	}
+	pthread_rwlock_unlock(&_idxlock);
+
+	return title;
+}
+
+/**
+ * returns the title in the live database with the given path
+ */
+mptitle_t *getTitleByPath(const char *path) {
+	uint32_t key = strhash(path);
+	mphashentry_t *entry = NULL;
+
+	pthread_rwlock_rdlock(&_idxlock);
+	if (_pathidx != NULL) {
+		entry = hashFirst(_pathidx, key);
+	}
+	while ((entry != NULL) &&
+		   strcmp(((mptitle_t *) entry->data)->path, path)) {
+		entry = hashNext(entry);
+	}
+	pthread_rwlock_unlock(&_idxlock);
+
+	return (entry != NULL) ? (mptitle_t *) entry->data : NULL;
+}
+
+/**
+ * returns a title in the live database with the given filename
+ * the check is case insensitive
+ */
+mptitle_t *getTitleByName(const char *name) {
+	uint32_t key = strihash(name);
+	mphashentry_t *entry = NULL;
+
+	pthread_rwlock_rdlock(&_idxlock);
+	if (_nameidx != NULL) {
+		entry = hashFirst(_nameidx, key);
+	}
+	while ((entry != NULL) &&
+		   strcasecmp(fname(((mptitle_t *) entry->data)->path), name)) {
+		entry = hashNext(entry);
+	}
+	pthread_rwlock_unlock(&_idxlock);
+
+	return (entry != NULL) ? (mptitle_t *) entry->data : NULL;
+}
+
+/**
+ * collects the titles of node and all its subdirectories into titles
+ */
+static uint32_t dbDirCollect(const mpdir_t * node, mptitle_t *** titles,
+							 uint32_t num) {
+	const mpdir_t *child;
+
+	if (node->num > 0) {
+		*titles = (mptitle_t **) frealloc(*titles,
+										  (num + node->num + 1) *
+										  sizeof (mptitle_t *));
+		memcpy(*titles + num, node->titles, node->num * sizeof (mptitle_t *));
+		num += node->num;
+	}
+
+	for (child = node->child; child != NULL; child = child->sibling) {
+		num = dbDirCollect(child, titles, num);
 	}
-	while (runner != base);
+
+	return num;
+}
+
+/**
+ * returns a NULL terminated list of all titles in the live database that
+ * are in the given directory or below. The list must be free'd by the
+ * caller. Returns NULL if there are no such titles.
+ */
+mptitle_t **getTitlesInDir(const char *dir) {
+	char path[MAXPATHLEN];
+	mptitle_t **titles = NULL;
+	mpdir_t *node;
+	size_t len;
+	uint32_t num = 0;
+
+	if (getConfig()->root == NULL) {
+		return NULL;
+	}
+
+	strtcpy(path, dir, MAXPATHLEN);
+	len = strlen(path);
+	while ((len > 0) && (path[len - 1] == '/')) {
+		path[--len] = 0;
+	}
+
+	pthread_rwlock_rdlock(&_idxlock);
+	node = dbDirFind(path);
+	if (node != NULL) {
+		num = dbDirCollect(node, &titles, 0);
+	}
+	pthread_rwlock_unlock(&_idxlock);
+
+	if (num == 0) {
+		return NULL;
+	}
+	titles[num] = NULL;
+
+	return titles;
+}
+
+/**
+ * returns true if the key is shorter than len but long enough to match
+ * a longer text at all
+ */
+static bool dbShortKeyLen(const char *lokey, size_t len) {
+	size_t klen = strlen(lokey);
+
+	return (klen >= 3) && (klen < len);
+}
+
+/**
+ * returns true if one of the search keys of the title is shorter than len
+ * and may still match a pattern with len characters
+ */
+static bool dbShortKey(const mptitle_t * title, size_t len) {
+	return dbShortKeyLen(title->lotitle, len) ||
+		dbShortKeyLen(title->loartist, len) ||
+		dbShortKeyLen(title->loalbum, len) ||
+		dbShortKeyLen(title->lodisplay, len);
+}
+
+/**
+ * returns a NULL terminated list of the titles in the live database that
+ * may match the pattern lopat, which must be prepared by patPrep(). The
+ * titles are in the order of the database and still need to be checked
+ * with patMatchPrep(). The list must be free'd by the caller.
+ * If within is given, only titles from that list in database order and
+ * titles with keys shorter than the pattern are returned. This is used to
+ * refine the result of an earlier search.
+ * Returns NULL if all titles need to be checked.
+ */
+mptitle_t **dbFindTitles(const char *lopat, mptitle_t ** within) {
+	size_t len = strlen(lopat);
+	mptitle_t **titles;
+	mptitle_t *title;
+	mptrihit_t *hits;
+	uint32_t need;
+	uint32_t num;
+	uint32_t found = 0;
+	uint32_t w = 0;
+
+	if ((getConfig()->root == NULL) || (len == 0)) {
+		return NULL;
+	}
+
+	/* patMatch() needs all characters of a pattern up to MATCHLEVEL, so
+	 * these keys have every trigram of the pattern. A key that is shorter
+	 * than the pattern becomes the pattern and still shares a trigram.
+	 * A pattern with less than three characters only matches keys that are
+	 * just the same.
+	 * Longer patterns also match characters one position late. Switching
+	 * between both breaks every trigram without losing a single match, so
+	 * there is no lower bound and the trigrams cannot tell anything. */
+	if (len > MATCHLEVEL) {
+		if (within == NULL) {
+			return NULL;
+		}
+		pthread_rwlock_rdlock(&_idxlock);
+		if (_keyidx == NULL) {
+			pthread_rwlock_unlock(&_idxlock);
+			return NULL;
+		}
+		titles = (mptitle_t **) falloc(_keylen + 1, sizeof (mptitle_t *));
+		for (uint32_t i = 0; i < _keylen; i++) {
+			title = _keyidx[i];
+			if (title == NULL) {
+				continue;
+			}
+			while ((within[w] != NULL) && (within[w]->key < title->key)) {
+				w++;
+			}
+			if ((within[w] == title) || dbShortKey(title, len)) {
+				titles[found++] = title;
+			}
+		}
+		pthread_rwlock_unlock(&_idxlock);
+		titles[found] = NULL;
+		return titles;
+	}
+	need = (len < 3) ? 1 : trigramNum(lopat);
+
+	pthread_rwlock_rdlock(&_idxlock);
+	if (_trgidx == NULL) {
+		pthread_rwlock_unlock(&_idxlock);
+		return NULL;
+	}
+	num = trigramFind(_trgidx, lopat, &hits);
+	titles = (mptitle_t **) falloc(num + 1, sizeof (mptitle_t *));
+	for (uint32_t i = 0; i < num; i++) {
+		if (hits[i].id >= _keylen) {
+			continue;
+		}
+		/* the key belonged to a removed title */
+		title = _keyidx[hits[i].id];
+		if (title == NULL) {
+			continue;
+		}
+		if (within != NULL) {
+			while ((within[w] != NULL) && (within[w]->key < title->key)) {
+				w++;
+			}
+			if (within[w] == title) {
+				titles[found++] = title;
+				continue;
+			}
+		}
+		else if (hits[i].hits >= need) {
+			titles[found++] = title;
+			continue;
+		}
+		if (dbShortKey(title, len)) {
+			titles[found++] = title;
+		}
+	}
+	pthread_rwlock_unlock(&_idxlock);
+	titles[found] = NULL;
+	free(hits);
+
+	return titles;
+}
+
+/**
+ * searches for a title that fits the name in the range.
+ * This is kind of a hack to turn an artist name or an album name into
+ * a title that can be used for FAV/DNP marking.
+ */
+mptitle_t *getTitleForRange(const mpcmd_t range, const char *name) {
+	/* start with the current title so we can notice it disappear on DNP */
+	mptitle_t *root = getConfig()->current->title;
+	mptitle_t *run = root;
+	uint32_t id;
+
+	if (root == NULL) {
+		return NULL;
+	}
+
+	/* a name that is not in the pool cannot match any title */
+	id = internFind(name);
+	if (id == 0) {
+		return NULL;
+	}
+
+	if (!MPC_EQALBUM(range) && !MPC_EQARTIST(range)) {
+		addMessage(0,
+				   "Can only search represantatives for Artists and Albums!");
+		return NULL;
+	}
+
+	do {
+		if (MPC_EQALBUM(range) && (run->albumid == id)) {
+			return run;
+		}
+		if (MPC_EQARTIST(range) && (run->artistid == id)) {
+			return run;
+		}
+		run = run->next;
+	} while (root != run);
 
 	return NULL;
 }
@@ -140,8 +1118,8 @@ int32_t mp3Exists(const mptitle_t * title) {
 }
 
 /**
- * deletes an entry from the database list
- * This should only be used on a database cleanup!
+ * unlinks an entry from a list of titles and frees it
+ * returns the next title or NULL if that was the last one
  */
 static mptitle_t *removeTitle(mptitle_t * entry) {
 	mptitle_t *next = NULL;
@@ -152,44 +1130,52 @@ static mptitle_t *removeTitle(mptitle_t * entry) {
 		entry->prev->next = entry->next;
 	}
 
-	remFromPLByKey(entry->key);
-
-	free(entry);
+	freeTitle(entry);
 	return next;
 }
 
+/**
+ * removes a title from the live database and keeps the root valid
+ * must be called with the catalogue locked!
+ */
+static void dbDropTitle(mptitle_t * title) {
+	mptitle_t *root = getConfig()->root;
+
+	addMessage(1, "Removing %s", title->path);
+	/* takes the playlist lock, so not with the titles locked */
+	remFromPLByKey(title->key);
+
+	pthread_rwlock_wrlock(&_idxlock);
+	if (title == root) {
+		root = (title->next == title) ? NULL : title->next;
+		getConfig()->root = root;
+	}
+	dbIndexDel(title);
+	removeTitle(title);
+
+	/* the indices stay valid for the rest of the titles */
+	if (root == NULL) {
+		dbIndexClear();
+	}
+	else if (_idxroot == title) {
+		_idxroot = root;
+	}
+	pthread_rwlock_unlock(&_idxlock);
+}
+
 
 /**
  * turn a database entry into a mixplay structure
  */
 static void db2entry(dbentry_t * dbentry, mptitle_t * entry) {
-	memset(entry, 0, ESIZE);
-	strcpy(entry->path, dbentry->path);
-	strcpy(entry->artist, dbentry->artist);
-	strcpy(entry->title, dbentry->title);
-	strcpy(entry->album, dbentry->album);
-	strcpy(entry->genre, dbentry->genre);
-	strtcpy(entry->display, dbentry->artist, MAXPATHLEN - 1);
-	strtcat(entry->display, " - ", MAXPATHLEN - 1);
-	strtcat(entry->display, dbentry->title, MAXPATHLEN - 1);
+	internText(entry, &entry->path, dbentry->path);
+	internTags(entry, dbentry->artist, dbentry->title, dbentry->album,
+			   dbentry->genre);
 	entry->playcount = dbentry->playcount;
 	entry->skipcount = dbentry->skipcount;
 	entry->favpcount = dbentry->playcount;
 	entry->flags = 0;
-}
-
-/**
- * pack a mixplay entry into a database structure
- */
-static void entry2db(mptitle_t * entry, dbentry_t * dbentry) {
-	memset(dbentry, 0, DBESIZE);
-	strcpy(dbentry->path, entry->path);
-	strcpy(dbentry->artist, entry->artist);
-	strcpy(dbentry->title, entry->title);
-	strcpy(dbentry->album, entry->album);
-	strcpy(dbentry->genre, entry->genre);
-	dbentry->playcount = entry->playcount;
-	dbentry->skipcount = entry->skipcount;
+	internTitle(entry);
 }
 
 /**
@@ -207,45 +1193,292 @@ static int32_t dbOpen(void) {
 	else {
 		addMessage(2, "Opened database %s", path);
 	}
-	return db;
+	return db;
+}
+
+/**
+ * returns the size of the title's record in the database, aligned to
+ * 64 bits
+ */
+static size_t dbRecordSize(const mptitle_t * title) {
+	size_t len = DBRSIZE + 10;
+
+	len += strlen(title->path) + strlen(title->artist) +
+		strlen(title->title) + strlen(title->album) + strlen(title->genre);
+
+	return (len + 7) & ~((size_t) 7);
+}
+
+/**
+ * returns the offset of the first record behind the header and the
+ * offsets of num records
+ */
+static size_t dbRecordStart(uint32_t num) {
+	return (DBHSIZE + (size_t) num * 4 + 7) & ~((size_t) 7);
+}
+
+/**
+ * re-keys the titles and encodes them into a snapshot of the database
+ * file. This only touches memory so it is cheap enough to be done on
+ * any thread.
+ */
+static dbsnap_t *dbSnapshot(mptitle_t * root) {
+	mptitle_t *runner = root;
+	dbsnap_t *snap;
+	dbheader_t *head;
+	uint32_t *offsets;
+	uint8_t *buff;
+	size_t size;
+	uint32_t num = 0;
+
+	/* get the size first so the database can be written in one go */
+	do {
+		num++;
+		runner = runner->next;
+	}
+	while (runner != root);
+
+	size = dbRecordStart(num);
+	do {
+		size += dbRecordSize(runner);
+		runner = runner->next;
+	}
+	while (runner != root);
+
+	buff = (uint8_t *) falloc(size, 1);
+	head = (dbheader_t *) buff;
+	memcpy(head->magic, DBMAGIC, 4);
+	head->version = DBVERSION;
+	head->count = num;
+	head->size = size;
+	offsets = (uint32_t *) (buff + DBHSIZE);
+
+	size = dbRecordStart(num);
+	num = 0;
+	do {
+		dbrecord_t *record = (dbrecord_t *) (buff + size);
+		uint8_t *pos = record->data;
+
+		runner->key = ++num;
+		offsets[num - 1] = size;
+		record->playcount = runner->playcount;
+		record->skipcount = runner->skipcount;
+		record->size = runner->size;
+		record->mtime = runner->mtime;
+		record->inode = runner->inode;
+		pos = dbPutString(pos, runner->path);
+		pos = dbPutString(pos, runner->artist);
+		pos = dbPutString(pos, runner->title);
+		pos = dbPutString(pos, runner->album);
+		dbPutString(pos, runner->genre);
+		size += dbRecordSize(runner);
+		runner = runner->next;
+	}
+	while (runner != root);
+
+	snap = (dbsnap_t *) falloc(1, sizeof (dbsnap_t));
+	snap->buff = buff;
+	snap->size = size;
+
+	/* count changes after this point have to go into the new file too */
+	pthread_mutex_lock(&_dbmaplock);
+	snap->jrnpos = _jrnnum;
+	_dbsnaps++;
+	pthread_mutex_unlock(&_dbmaplock);
+
+	return snap;
+}
+
+/**
+ * drops a snapshot that will not be stored
+ */
+static void dbSnapDrop(dbsnap_t * snap) {
+	pthread_mutex_lock(&_dbmaplock);
+	_dbsnaps--;
+	pthread_mutex_unlock(&_dbmaplock);
+	free(snap->buff);
+	free(snap);
+}
+
+/**
+ * applies journal entries from position 'from' on to the mapped records.
+ * must be called with the _dbmaplock held!
+ */
+static void dbJournalApply(uint32_t from) {
+	dbjournal_t entries[64];
+	char path[MAXPATHLEN + 1];
+	ssize_t len;
+	int32_t fd;
+
+	dbJournalPath(path);
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return;
+	}
+
+	if (lseek(fd, from * JRNESIZE, SEEK_SET) == -1) {
+		close(fd);
+		return;
+	}
+
+	while ((len = read(fd, entries, sizeof (entries))) >= (ssize_t) JRNESIZE) {
+		for (uint32_t i = 0; i < len / JRNESIZE; i++) {
+			dbrecord_t *record = dbRecord(entries[i].key);
+
+			if ((record == NULL) ||
+				(dbGetString(dbRecordData(record), path,
+							 MAXPATHLEN) == NULL) ||
+				(strhash(path) != entries[i].hash)) {
+				continue;
+			}
+			record->playcount = entries[i].playcount;
+			record->skipcount = entries[i].skipcount;
+		}
+	}
+	close(fd);
+}
+
+/**
+ * writes a snapshot into a temporary file and replaces the database
+ * with it. The old file is kept as backup.
+ */
+static void dbStore(dbsnap_t * snap) {
+	char tmpname[MAXPATHLEN + 1];
+	int32_t db;
+
+	strtcpy(tmpname, getConfig()->dbname, MAXPATHLEN);
+	strtcat(tmpname, ".tmp", MAXPATHLEN);
+
+	db = open(tmpname, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (db == -1) {
+		addAlert(0, "Could not create %s: %s", tmpname, strerror(errno));
+		dbSnapDrop(snap);
+		return;
+	}
+
+	if ((dowrite(db, (char *) snap->buff, snap->size) == -1) ||
+		(fsync(db) == -1)) {
+		fail(errno, "Could not write database %s!", tmpname);
+	}
+
+	pthread_mutex_lock(&_dbmaplock);
+	fileBackup(getConfig()->dbname);
+	if (rename(tmpname, getConfig()->dbname) == -1) {
+		fail(errno, "Could not replace database %s!", getConfig()->dbname);
+	}
+	pthread_mutex_unlock(&_dbmaplock);
+
+	dbMap(db);
+	dbClose(db);
+
+	pthread_mutex_lock(&_dbmaplock);
+	/* catch up with the changes that happened during the write */
+	dbJournalApply(snap->jrnpos);
+	_dbsnaps--;
+	/* a newer snapshot still needs the journal */
+	if (_dbsnaps == 0) {
+		dbJournalSync();
+	}
+	pthread_mutex_unlock(&_dbmaplock);
+
+	free(snap->buff);
+	free(snap);
+}
+
+/**
+ * the database writer thread, stores queued snapshots until the end
+ */
+static void *dbWriter(void *arg) {
+	dbsnap_t *snap;
+
+	(void) arg;
+	pthread_mutex_lock(&_dbwlock);
+	while (1) {
+		while (_dbwqueue == NULL) {
+			pthread_cond_wait(&_dbwcond, &_dbwlock);
+		}
+		snap = _dbwqueue;
+		_dbwqueue = NULL;
+		_dbwbusy = true;
+		pthread_mutex_unlock(&_dbwlock);
+
+		dbStore(snap);
+
+		pthread_mutex_lock(&_dbwlock);
+		_dbwbusy = false;
+		pthread_cond_broadcast(&_dbwdone);
+	}
+
+	return NULL;
 }
 
 /**
- * adds/overwrites a title to/in the database
+ * waits until the writer thread has stored all snapshots
  */
-static int32_t dbPutTitle(int32_t db, mptitle_t * title) {
-	dbentry_t dbentry;
+static void dbWait(void) {
+	pthread_mutex_lock(&_dbwlock);
+	while ((_dbwqueue != NULL) || _dbwbusy) {
+		pthread_cond_wait(&_dbwdone, &_dbwlock);
+	}
+	pthread_mutex_unlock(&_dbwlock);
+}
 
-	assert(0 != db);
+/**
+ * starts the writer thread if it is not running yet, must be called with
+ * _dbwlock held!
+ * The writer should be started on load, so it does not inherit the
+ * priority of a throttled background job.
+ */
+static bool dbWriterStart(void) {
+	pthread_t tid;
 
-	if (0 == title->key) {
-		lseek(db, 0, SEEK_END);
-	}
-	else {
-		if (-1 == lseek(db, DBESIZE * (title->key - 1), SEEK_SET)) {
-			fail(errno, "Could not skip to title %s", title->path);
+	if (!_dbwrunning) {
+		if (pthread_create(&tid, NULL, dbWriter, NULL) != 0) {
+			addMessage(0, "Could not start database writer!");
+			return false;
 		}
+		pthread_setname_np(tid, "dbwriter");
+		pthread_detach(tid);
+		_dbwrunning = true;
 	}
+	return true;
+}
 
-	entry2db(title, &dbentry);
+/**
+ * hands a snapshot to the writer thread. A snapshot that has not been
+ * picked up yet is replaced, as the new one contains all its changes.
+ * if wait is true, this returns once the snapshot is stored.
+ */
+static void dbQueue(dbsnap_t * snap, bool wait) {
+	dbsnap_t *old;
 
-	if (write(db, &dbentry, DBESIZE) != DBESIZE) {
-		fail(errno, "Could not write entry %s!", title->path);
+	pthread_mutex_lock(&_dbwlock);
+	if (!dbWriterStart()) {
+		pthread_mutex_unlock(&_dbwlock);
+		dbStore(snap);
+		return;
+	}
+	old = _dbwqueue;
+	_dbwqueue = snap;
+	pthread_cond_signal(&_dbwcond);
+	pthread_mutex_unlock(&_dbwlock);
+
+	if (old != NULL) {
+		addMessage(2, "Dropped outdated database snapshot");
+		dbSnapDrop(old);
 	}
 
-	return 0;
+	if (wait) {
+		dbWait();
+	}
 }
 
 /**
- * takes a database entry and adds it to a mixplay entry list
- * if there is no list, a new one will be created
+ * fills a cleared entry from a database entry and appends it to a
+ * mixplay entry list. If there is no list, a new one will be created
  */
-static mptitle_t *addDBTitle(dbentry_t * dbentry, mptitle_t * root,
-							 uint32_t index) {
-	mptitle_t *entry;
-
-	entry = (mptitle_t *) falloc(1, sizeof (mptitle_t));
-
+static mptitle_t *addDBTitle(dbentry_t * dbentry, mptitle_t * entry,
+							 mptitle_t * root, uint32_t index) {
 	db2entry(dbentry, entry);
 	entry->key = index;
 
@@ -271,8 +1504,16 @@ mptitle_t *dbGetMusic() {
 	dbentry_t dbentry;
 	uint32_t index = 1;			/* index 0 is reserved for titles not in the db! */
 	mptitle_t *dbroot = NULL;
+	mptitle_t *titles = NULL;
 	int32_t db;
-	size_t len;
+	int32_t num;
+	int32_t count;
+
+	/* make sure the file is up to date */
+	dbWait();
+	pthread_mutex_lock(&_dbwlock);
+	dbWriterStart();
+	pthread_mutex_unlock(&_dbwlock);
 
 	db = dbOpen();
 	if (db == -1) {
@@ -280,7 +1521,22 @@ mptitle_t *dbGetMusic() {
 	}
 
 	activity(1, "Loading database");
-	while ((len = read(db, &dbentry, DBESIZE)) == DBESIZE) {
+	num = dbMap(db);
+	dbClose(db);
+
+	/* load all titles into one block */
+	count = num;
+	if (num > 0) {
+		titles = allocTitles(num);
+	}
+
+	pthread_mutex_lock(&_dbmaplock);
+	while ((int32_t) index <= num) {
+		if (dbGetEntry(index, &dbentry) == -1) {
+			num = -1;
+			break;
+		}
+
 		/* explicitly terminate strings. Those should never ever be not terminated,
 		 * but it may make a change on reading a corrupted database */
 		dbentry.path[MAXPATHLEN - 1] = 0;
@@ -297,13 +1553,31 @@ mptitle_t *dbGetMusic() {
 			 * on the open database! */
 			getConfig()->dbDirty = 1;
 		}
-		dbroot = addDBTitle(&dbentry, dbroot, index);
+		dbroot = addDBTitle(&dbentry, &titles[index - 1], dbroot, index);
+		dbGetStat(index, dbroot);
 		index++;
 	}
 
-	dbClose(db);
+	/* release the titles that were not loaded */
+	if (num == -1) {
+		for (int32_t i = index; i <= count; i++) {
+			freeTitle(&titles[i - 1]);
+		}
+	}
+
+	/* apply changes that did not make it into the database yet */
+	if ((num > 0) && (dbJournalReplay(titles, num) > 0)) {
+		addMessage(1, "Applied journal");
+		dbJournalSync();
+	}
+	pthread_mutex_unlock(&_dbmaplock);
 
-	if (0 != len) {
+	if ((num > 0) && (_dbmapver != DBVERSION)) {
+		addMessage(0, "Converting database to version %i", DBVERSION);
+		dbQueue(dbSnapshot(dbroot->next), true);
+	}
+
+	if (num == -1) {
 		addMessage(0, "Database is corrupt, trying backup.");
 		dbroot = wipeTitles(dbroot);
 		if (!fileRevert(getConfig()->dbname)) {
@@ -322,92 +1596,372 @@ mptitle_t *dbGetMusic() {
 	return (dbroot ? dbroot->next : NULL);
 }
 
+/* a directory of the live database as it was when the check started */
+typedef struct {
+	char *path;					/* full path without trailing slash */
+	uint32_t num;
+	uint32_t *keys;				/* keys of the titles in the directory */
+	char **paths;				/* and their paths */
+} dbcheckdir_t;
+
+/* shared state of the existence check workers */
+typedef struct {
+	dbcheckdir_t *dirs;			/* directories that contain titles */
+	uint32_t num;
+	uint32_t next;				/* next directory to check */
+	uint32_t done;				/* number of checked directories */
+	uint32_t *missing;			/* keys of titles that no longer exist */
+	const char **mpaths;		/* and their paths */
+	uint32_t mnum;
+	pthread_mutex_t lock;
+} dbcheck_t;
+
+/**
+ * adds a title to the list of missing titles
+ */
+static void dbCheckMissing(dbcheck_t * check, const dbcheckdir_t * node,
+						   uint32_t i) {
+	pthread_mutex_lock(&check->lock);
+	check->missing = (uint32_t *) frealloc(check->missing,
+										   (check->mnum + 1) *
+										   sizeof (uint32_t));
+	check->mpaths = (const char **) frealloc(check->mpaths,
+											 (check->mnum + 1) *
+											 sizeof (char *));
+	check->missing[check->mnum] = node->keys[i];
+	check->mpaths[check->mnum] = node->paths[i];
+	check->mnum++;
+	pthread_mutex_unlock(&check->lock);
+}
+
+/**
+ * checks the titles of one directory with a single directory read
+ */
+static void dbCheckDir(dbcheck_t * check, const dbcheckdir_t * node) {
+	char path[MAXPATHLEN + 1];
+	mphash_t *names;
+	mphashentry_t *entry;
+	struct dirent *de;
+	DIR *dir;
+
+	/* fullpath() is not thread safe */
+	if (node->path[0] == '/') {
+		strtcpy(path, node->path, MAXPATHLEN);
+	}
+	else {
+		snprintf(path, MAXPATHLEN, "%s%s", getConfig()->musicdir, node->path);
+	}
+
+	dir = opendir(path);
+	if (dir == NULL) {
+		bool gone = (errno == ENOENT);
+
+		for (uint32_t i = 0; i < node->num; i++) {
+			/* only trust a missing directory, otherwise check each file */
+			if (gone) {
+				dbCheckMissing(check, node, i);
+			}
+			else {
+				snprintf(path, MAXPATHLEN, "%s%s",
+						 (node->path[0] == '/') ? "" : getConfig()->musicdir,
+						 node->paths[i]);
+				if (access(path, F_OK) != 0) {
+					dbCheckMissing(check, node, i);
+				}
+			}
+		}
+		return;
+	}
+
+	names = hashInit(node->num * 2);
+	while ((de = readdir(dir)) != NULL) {
+		hashAdd(names, strhash(de->d_name), strdup(de->d_name));
+	}
+	closedir(dir);
+
+	for (uint32_t i = 0; i < node->num; i++) {
+		const char *name = fname(node->paths[i]);
+
+		for (entry = hashFirst(names, strhash(name)); entry != NULL;
+			 entry = hashNext(entry)) {
+			if (strcmp((char *) entry->data, name) == 0) {
+				break;
+			}
+		}
+		if (entry == NULL) {
+			dbCheckMissing(check, node, i);
+		}
+	}
+
+	for (uint32_t i = 0; i < names->size; i++) {
+		for (entry = names->bucket[i]; entry != NULL; entry = entry->next) {
+			free(entry->data);
+		}
+	}
+	hashWipe(names);
+}
+
+/**
+ * worker thread for dbCheckExist(), takes directories until all are done
+ */
+static void *dbCheckWorker(void *arg) {
+	dbcheck_t *check = (dbcheck_t *) arg;
+	uint32_t index;
+
+	while (1) {
+		pthread_mutex_lock(&check->lock);
+		index = check->next++;
+		pthread_mutex_unlock(&check->lock);
+		if (index >= check->num) {
+			break;
+		}
+
+		dbCheckDir(check, &check->dirs[index]);
+		throttle(check->dirs[index].num, 0);
+
+		pthread_mutex_lock(&check->lock);
+		check->done++;
+		setProcess((100 * check->done) / check->num);
+		pthread_mutex_unlock(&check->lock);
+	}
+
+	return NULL;
+}
+
+/**
+ * copies the directories of the live database that contain titles, so
+ * they can be checked without the catalogue lock.
+ * must be called with the catalogue locked!
+ */
+static void dbCheckCollect(dbcheck_t * check) {
+	check->dirs = (dbcheckdir_t *) falloc(_dirnum, sizeof (dbcheckdir_t));
+	for (uint32_t i = 0; i < _dirnum; i++) {
+		const mpdir_t *node = _dirs[i];
+		dbcheckdir_t *copy = &check->dirs[check->num];
+
+		if (node->num == 0) {
+			continue;
+		}
+		copy->path = strdup(node->path);
+		copy->num = node->num;
+		copy->keys = (uint32_t *) falloc(node->num, sizeof (uint32_t));
+		copy->paths = (char **) falloc(node->num, sizeof (char *));
+		for (uint32_t j = 0; j < node->num; j++) {
+			copy->keys[j] = node->titles[j]->key;
+			copy->paths[j] = strdup(node->titles[j]->path);
+		}
+		check->num++;
+	}
+}
+
 /**
  * checks for removed entries in the database
  * i.e. titles that are in the database but no longer on the medium
+ *
+ * Each directory is read just once and the directories are checked in
+ * parallel, so slow network mounts do not add up the latency per title.
+ * The check runs on a copy of the directories, the catalogue is only
+ * locked to take the copy and to drop the missing titles.
  */
 int32_t dbCheckExist(void) {
-	mptitle_t *root;
-	mptitle_t *runner;
+	dbcheck_t check;
+	pthread_t tid[DBCHECKWORKERS];
+	uint32_t workers = 0;
+	uint32_t load;
 	int32_t num = 0;
 
-	root = getConfig()->root;
-	if (root == NULL) {
+	memset(&check, 0, sizeof (check));
+	pthread_mutex_init(&check.lock, NULL);
+
+	lockCatalog();
+	if (getConfig()->root == NULL) {
+		unlockCatalog();
 		addAlert(0, "No music in database!");
 		return -1;
 	}
-	runner = root;
 	addMessage(0, "Cleaning database");
-	do {
-		if (!mp3Exists(runner)) {
-			if (root == runner) {
-				root = runner->prev;
-			}
-
-			runner = removeTitle(runner);
-			num++;
-		}
-		else {
-			runner = runner->next;
+	load = _dbload;
+	dbCheckCollect(&check);
+	unlockCatalog();
+
+	for (uint32_t i = 0; (i < DBCHECKWORKERS) && (i < check.num); i++) {
+		if (pthread_create(&tid[workers], NULL, dbCheckWorker, &check) == 0) {
+			pthread_setname_np(tid[workers], "dbcheck");
+			workers++;
 		}
 	}
-	while ((runner != NULL) && (root != runner));
+	/* no workers at all? Then do it alone */
+	if (workers == 0) {
+		dbCheckWorker(&check);
+	}
+	for (uint32_t i = 0; i < workers; i++) {
+		pthread_join(tid[i], NULL);
+	}
+	setProcess(0);
+	pthread_mutex_destroy(&check.lock);
+
+	/* titles may have been moved or removed meanwhile */
+	lockCatalog();
+	if (load != _dbload) {
+		addMessage(0, "The database was replaced, dropping the check");
+	}
+	else {
+		for (uint32_t i = 0; i < check.mnum; i++) {
+			mptitle_t *title = getTitleByIndex(check.missing[i]);
 
-	if (runner == NULL) {
-		getConfig()->root = NULL;
+			if ((title != NULL) && (strcmp(title->path, check.mpaths[i]) == 0)) {
+				dbDropTitle(title);
+				num++;
+			}
+		}
 	}
-	else if (num > 0) {
+	if ((getConfig()->root != NULL) && (num > 0)) {
 		dbMarkDirty();
 	}
+	unlockCatalog();
+
+	for (uint32_t i = 0; i < check.num; i++) {
+		for (uint32_t j = 0; j < check.dirs[i].num; j++) {
+			free(check.dirs[i].paths[j]);
+		}
+		free(check.dirs[i].paths);
+		free(check.dirs[i].keys);
+		free(check.dirs[i].path);
+	}
+	free(check.dirs);
+	free(check.missing);
+	free(check.mpaths);
 
 	return num;
 }
 
-static int32_t dbAddTitle(int32_t db, mptitle_t * title) {
-	dbentry_t dbentry;
+/**
+ * gives a title a new path, the counts and tags are kept
+ */
+static void dbMoveTitle(mptitle_t * title, const char *path) {
+	addMessage(1, "Moved %s to %s", title->path, path);
+	pthread_rwlock_wrlock(&_idxlock);
+	dbIndexDel(title);
+	internText(title, &title->path, path);
+	if ((_pathidx != NULL) && (_idxroot == getConfig()->root)) {
+		dbIndexPut(title);
+	}
+	pthread_rwlock_unlock(&_idxlock);
+}
+
+/**
+ * takes the tags and the file state of a freshly scanned title,
+ * the counts are kept
+ */
+static void dbRefreshTitle(mptitle_t * title, const mptitle_t * scanned) {
+	internTags(title, scanned->artist, scanned->title, scanned->album,
+			   scanned->genre);
+	title->size = scanned->size;
+	title->mtime = scanned->mtime;
+	title->inode = scanned->inode;
+	internTitle(title);
+	/* the old trigrams stay, they only cost a check in search */
+	pthread_rwlock_wrlock(&_idxlock);
+	if ((_trgidx != NULL) && (_idxroot == getConfig()->root)) {
+		dbIndexSearch(title);
+	}
+	pthread_rwlock_unlock(&_idxlock);
+	_dbgen++;
+}
 
-	assert(0 != db);
+/**
+ * checks if the file at path is in the database and did not change since
+ * the last scan. During a scan such titles are marked as seen, so
+ * dbAddTitles() can tell moved files from new ones. Titles from older
+ * databases adopt the file state without reading the tags again.
+ * The scan runs without the catalogue lock, so the titles are locked
+ * while the title is updated.
+ */
+bool dbFileUnchanged(const char *path, uint64_t size, int64_t mtime,
+					 uint64_t inode) {
+	mptitle_t *title;
+	bool unchanged = false;
 
-	lseek(db, 0, SEEK_END);
+	if (getConfig()->root == NULL) {
+		return false;
+	}
 
-	entry2db(title, &dbentry);
+	dbLockTitles();
+	title = getTitleByPath(path);
+	if ((title != NULL) && (title->size == 0) && (title->mtime == 0)) {
+		title->size = size;
+		title->mtime = mtime;
+		_dbadopted++;
+	}
+	if ((title != NULL) && (title->size == size) && (title->mtime == mtime)) {
+		/* a restored backup may keep the time but not the inode */
+		if (title->inode != inode) {
+			title->inode = inode;
+			_dbadopted++;
+		}
 
-	if (write(db, &dbentry, DBESIZE) != DBESIZE) {
-		fail(errno, "Could not write entry %s!", title->path);
+		if ((_dbseen != NULL) && (title->key < _dbseenlen)) {
+			_dbseen[title->key >> 5] |= 1U << (title->key & 31);
+		}
+		_dbknown++;
+		unchanged = true;
 	}
+	dbUnlockTitles();
 
-	return 0;
+	return unchanged;
 }
 
 /**
- * the name is misleading, it just is chosen to match addNewPath()
- * where it is used
+ * returns the unmarked title that was moved to the new title's file
+ * and removes it from the candidates
  */
-void dbAddPath(mptitle_t * title) {
-	int db = dbOpen();
+static mptitle_t *dbMoved(mphash_t * inodes, const mptitle_t * title) {
+	mphashentry_t *entry;
 
-	if (db == -1) {
-		fail(-1, "Database is not available!");
-		return;
+	if ((inodes == NULL) || (title->inode == 0)) {
+		return NULL;
 	}
-	dbAddTitle(db, title);
-	dbClose(db);
+
+	for (entry = hashFirst(inodes, (uint32_t) title->inode); entry != NULL;
+		 entry = hashNext(entry)) {
+		mptitle_t *moved = (mptitle_t *) entry->data;
+
+		/* a hard link is no move */
+		if ((moved->inode == title->inode) && (moved->size == title->size)
+			&& (moved->mtime == title->mtime) && !mp3Exists(moved)) {
+			hashDel(inodes, (uint32_t) moved->inode, moved);
+			return moved;
+		}
+	}
+
+	return NULL;
 }
 
 /**
  * adds new titles to the database
  * the new titles will have a playcount set to blend into the mix
+ *
+ * Only new and changed files are read by the scan. Changed files update
+ * their titles and files that were moved keep their counts, so this needs
+ * to run before dbCheckExist() on a cleanup.
+ * The database is not written, the caller needs to call dbWrite().
  */
 int32_t dbAddTitles(char *basedir) {
 	mptitle_t *fsroot;
 	mptitle_t *fsnext;
 	mptitle_t *dbroot;
 	mptitle_t *dbrunner;
+	mphash_t *inodes = NULL;
 	uint32_t mean = 0;
 	uint32_t index = 0;
-	int32_t num = 0, db = 0;
+	uint32_t changed = 0;
+	uint32_t load;
+	int32_t num = 0;
 
+	pthread_mutex_lock(&_scanlock);
+	lockCatalog();
 	dbroot = getConfig()->root;
+	load = _dbload;
 	if (dbroot == NULL) {
 		addMessage(0, "No database loaded!");
 	}
@@ -415,32 +1969,89 @@ int32_t dbAddTitles(char *basedir) {
 		addMessage(0, "Adding new titles");
 		index = dbroot->prev->key;
 		mean = getPlaycount(count_mean);
+
+		/* the scan marks the unchanged titles by key */
+		dbrunner = dbroot;
+		do {
+			if (dbrunner->key >= _dbseenlen) {
+				_dbseenlen = dbrunner->key + 1;
+			}
+			dbrunner = dbrunner->next;
+		} while (dbrunner != dbroot);
+		_dbseen = (uint32_t *) falloc((_dbseenlen + 31) / 32,
+									  sizeof (uint32_t));
 	}
+	unlockCatalog();
 
 	addMessage(0, "Using mean playcount %d", mean);
 	addMessage(0, "%d titles in current database", index);
-	index++;
 
-	/* scan directory */
+	/* scan directory, this reads the tags of new and changed files, so
+	 * it runs without the catalogue lock */
 	addMessage(0, "Scanning...");
+	_dbknown = 0;
+	_dbadopted = 0;
 	fsroot = recurse(basedir, NULL);
-	if (fsroot == NULL) {
+	changed = _dbadopted;
+	addMessage(1, "%" PRIu32 " titles did not change", _dbknown);
+
+	lockCatalog();
+	/* the marks belong to the database that was scanned */
+	if (load != _dbload) {
+		addMessage(0, "The database was replaced, dropping the scan");
+		free(_dbseen);
+		_dbseen = NULL;
+		_dbseenlen = 0;
+		wipeTitles(fsroot);
+		unlockCatalog();
+		pthread_mutex_unlock(&_scanlock);
+		return 0;
+	}
+
+	/* titles may have come and gone during the scan */
+	dbroot = getConfig()->root;
+	index = (dbroot != NULL) ? dbroot->prev->key : 0;
+
+	/* titles that were not found may have been moved */
+	if ((fsroot != NULL) && (dbroot != NULL) && (_dbseen != NULL)) {
+		inodes = hashInit(index);
+		dbrunner = dbroot;
+		do {
+			if (((dbrunner->key >= _dbseenlen) ||
+				 !(_dbseen[dbrunner->key >> 5] & (1U << (dbrunner->key & 31))))
+				&& (dbrunner->inode != 0)) {
+				hashAdd(inodes, (uint32_t) dbrunner->inode, dbrunner);
+			}
+			dbrunner = dbrunner->next;
+		} while (dbrunner != dbroot);
+	}
+	free(_dbseen);
+	_dbseen = NULL;
+	_dbseenlen = 0;
+
+	if ((fsroot == NULL) && (_dbknown == 0)) {
+		unlockCatalog();
+		pthread_mutex_unlock(&_scanlock);
 		addAlert(0, "No music found in<br>%s!", basedir);
 		return 0;
 	}
 
-	fsroot = fsroot->next;
+	fsroot = (fsroot != NULL) ? fsroot->next : NULL;
+	index++;
 
 	addMessage(0, "Adding titles...");
 
-	db = dbOpen();
-	if (db == -1) {
-		getConfig()->root = wipeTitles(getConfig()->root);
-		return -1;
-	}
-
 	while (NULL != fsroot) {
-		dbrunner = findTitle(dbroot, fsroot->path);
+		dbrunner = getTitleByPath(fsroot->path);
+		if (NULL == dbrunner) {
+			dbrunner = dbMoved(inodes, fsroot);
+			if (NULL != dbrunner) {
+				dbMoveTitle(dbrunner, fsroot->path);
+			}
+		}
+		else {
+			addMessage(1, "Updating %s", fsroot->display);
+		}
 
 		if (NULL == dbrunner) {
 			fsnext = fsroot->next;
@@ -453,13 +2064,11 @@ int32_t dbAddTitles(char *basedir) {
 			fsroot->favpcount = mean;
 			fsroot->key = index++;
 			addMessage(1, "Adding %s", fsroot->display);
-			dbAddTitle(db, fsroot);
 
-			/* unlink title from fsroot */
+			/* move title from fsroot to dbroot */
+			pthread_rwlock_wrlock(&_idxlock);
 			fsroot->prev->next = fsroot->next;
 			fsroot->next->prev = fsroot->prev;
-
-			/* add title to dbroot */
 			if (dbroot == NULL) {
 				dbroot = fsroot;
 				dbroot->prev = dbroot;
@@ -471,20 +2080,167 @@ int32_t dbAddTitles(char *basedir) {
 				fsroot->next = dbroot;
 				dbroot->prev = fsroot;
 			}
+			pthread_rwlock_unlock(&_idxlock);
+			dbIndexTitle(fsroot);
 			num++;
 
 			fsroot = fsnext;
 		}
 		else {
+			dbRefreshTitle(dbrunner, fsroot);
+			changed++;
 			fsroot = removeTitle(fsroot);
 		}
 	}
-	dbClose(db);
+	if (inodes != NULL) {
+		hashWipe(inodes);
+	}
 
 	if (getConfig()->root == NULL) {
 		addMessage(0, "Setting new active database");
-		getConfig()->root = dbroot;
+		dbSetRoot(dbroot);
+	}
+
+	/* the caller writes the database once it is done with all changes.
+	 * Do not use dbMarkDirty() here as that may trigger a write. */
+	if ((num > 0) || (changed > 0)) {
+		getConfig()->dbDirty++;
+	}
+	unlockCatalog();
+	pthread_mutex_unlock(&_scanlock);
+
+	return num;
+}
+
+/**
+ * adds the music file at path to the database or updates its title if the
+ * file changed since the last scan.
+ * returns 1 if the database changed
+ */
+int32_t dbUpdatePath(const char *path) {
+	mptitle_t *title;
+	mptitle_t *scanned;
+	struct stat st;
+
+	if ((getConfig()->root == NULL) || !isMusic(path) ||
+		(stat(path, &st) == -1) || !S_ISREG(st.st_mode)) {
+		return 0;
+	}
+
+	if (getTitleByPath(path) == NULL) {
+		title = addNewPath(path);
+		addMessage(1, "Adding %s", title->display);
+		return 1;
+	}
+
+	if (dbFileUnchanged(path, st.st_size, st.st_mtime, st.st_ino)) {
+		return 0;
+	}
+
+	/* the tags are read without the catalogue lock */
+	scanned = (mptitle_t *) falloc(1, sizeof (mptitle_t));
+	internText(scanned, &scanned->path, path);
+	scanned->size = st.st_size;
+	scanned->mtime = st.st_mtime;
+	scanned->inode = st.st_ino;
+	throttle(1, fillTagInfo(scanned));
+
+	lockCatalog();
+	title = getTitleByPath(path);
+	if (title != NULL) {
+		dbRefreshTitle(title, scanned);
+		addMessage(1, "Updating %s", title->display);
+	}
+	unlockCatalog();
+	freeTitle(scanned);
+
+	return (title != NULL) ? 1 : 0;
+}
+
+/**
+ * moves the title of the file at from or all titles below the directory
+ * from to the new path. A title that was replaced by the move is removed.
+ * returns the number of moved titles
+ */
+int32_t dbRenamePath(const char *from, const char *to) {
+	char path[MAXPATHLEN];
+	mptitle_t *title;
+	mptitle_t **titles;
+	size_t len = strlen(from);
+	int32_t num = 0;
+
+	lockCatalog();
+	if (getConfig()->root == NULL) {
+		unlockCatalog();
+		return 0;
+	}
+
+	title = getTitleByPath(from);
+	if (title != NULL) {
+		mptitle_t *old = getTitleByPath(to);
+
+		if (old != NULL) {
+			dbDropTitle(old);
+		}
+		dbMoveTitle(title, to);
+		unlockCatalog();
+		return 1;
+	}
+
+	titles = getTitlesInDir(from);
+	if (titles == NULL) {
+		unlockCatalog();
+		return 0;
+	}
+
+	for (uint32_t i = 0; titles[i] != NULL; i++) {
+		if (snprintf(path, MAXPATHLEN, "%s%s", to, titles[i]->path + len)
+			>= MAXPATHLEN) {
+			addMessage(0, "Path too long for %s", titles[i]->path);
+			continue;
+		}
+		dbMoveTitle(titles[i], path);
+		num++;
+	}
+	unlockCatalog();
+	free(titles);
+
+	return num;
+}
+
+/**
+ * removes the title of the file at path or all titles below the directory
+ * path, unless the path exists (again).
+ * returns the number of removed titles
+ */
+int32_t dbRemovePath(const char *path) {
+	mptitle_t *title;
+	mptitle_t **titles;
+	int32_t num = 0;
+
+	if ((getConfig()->root == NULL) || (access(path, F_OK) == 0)) {
+		return 0;
+	}
+
+	lockCatalog();
+	title = getTitleByPath(path);
+	if (title != NULL) {
+		dbDropTitle(title);
+		unlockCatalog();
+		return 1;
+	}
+
+	titles = getTitlesInDir(path);
+	if (titles == NULL) {
+		unlockCatalog();
+		return 0;
+	}
+
+	for (num = 0; titles[num] != NULL; num++) {
+		dbDropTitle(titles[num]);
 	}
+	unlockCatalog();
+	free(titles);
 
 	return num;
 }
@@ -532,6 +2288,10 @@ int32_t dbNameCheck(void) {
 	FILE *fp;
 	int32_t match;
 	char rmpath[MAXPATHLEN + 1];
+	mptitle_t **titles;
+	uint32_t *nextdup;
+	uint32_t num = 0;
+	mphash_t *names;
 
 	/* not using the live database as we need the marker */
 	/* TODO: this is no longer true, check! */
@@ -556,98 +2316,125 @@ int32_t dbNameCheck(void) {
 
 	fprintf(fp, "#!/bin/bash\n");
 
-	currentEntry = root;
-	while (currentEntry->next != root) {
-		if (!(currentEntry->flags & MP_MARK)) {
-			runner = currentEntry->next;
-			do {
-				if (!(runner->flags & MP_MARK)) {
-					/* if the titles identify the same, check their paths */
-					if (strcmp(runner->display, currentEntry->display) == 0) {
-						match = 0;
-						if (checkPath(runner, mpc_artist)) {
-							match |= 1;
-						}
-						if (checkPath(runner, mpc_album)) {
-							match |= 2;
-						}
-						if (checkPath(currentEntry, mpc_artist)) {
-							match |= 4;
-						}
-						if (checkPath(currentEntry, mpc_album)) {
-							match |= 8;
-						}
-
-						switch (match) {
-						case 1:	/* 0001 */
-						case 2:	/* 0010 */
-						case 3:	/* 0011 */
-						case 7:	/* 0111 */
-						case 11:	/* 1011 */
-							/* runner is in an album, currentEntry in a mix */
-							handleDBL(currentEntry);
-							addMessage(1, "Marked %s", currentEntry->path);
-							fprintf(fp, "## Original at %s\n", runner->path);
-							fprintf(fp,
-									"rm \"%s\" >> %s/.mixplay/mixplay.dbl\n\n",
-									currentEntry->path, getenv("HOME"));
-							runner->flags |= MP_MARK;
-							count++;
-							break;
-						case 4:	/* 0100 */
-						case 8:	/* 1000 */
-						case 12:	/* 1100 */
-						case 13:	/* 1101 */
-						case 14:	/* 1110 */
-							/* currentEntry is in an album, runner in a mix */
-							handleDBL(runner);
-							addMessage(1, "Marked %s", runner->path);
-							fprintf(fp, "## Original at %s\n",
-									currentEntry->path);
-							fprintf(fp,
-									"rm \"%s\" >> %s/.mixplay/mixplay.dbl\n\n",
-									runner->path, getenv("HOME"));
-							currentEntry->flags |= MP_MARK;
-							count++;
-							break;
-						case 0:	/* 0000 */
-						case 5:	/* 0101 */
-						case 6:	/* 0110 */
-						case 9:	/* 1001 */
-						case 10:	/* 1010 */
-							/* both seem to be in a sampler/mix */
-							fprintf(fp, "## Uncertain match! Either:\n");
-							fprintf(fp, "#rm \"%s\"\n", currentEntry->path);
-							fprintf(fp,
-									"#echo \"%s\" >>  %s/.mixplay/mixplay.dbl\n",
-									currentEntry->path, getenv("HOME"));
-							fprintf(fp, "## Or:\n");
-							fprintf(fp, "#rm \"%s\"\n", runner->path);
-							fprintf(fp,
-									"#echo \"%s\" >>  %s/.mixplay/mixplay.dbl\n\n",
-									runner->path, getenv("HOME"));
-							runner->flags |= MP_MARK;	/* make sure only one of the doublets is used for future checkings */
-							qcnt++;
-							break;
-						case 15:	/* 1111 */
-							/* both titles are fine! */
-							break;
-						default:
-							addMessage(0, "Incorrect match: %i", match);
-							break;
-						}
-					}
+	/* group titles by display name. Only titles with the same name can
+	 * be doublets, so each title only needs to be checked against the
+	 * following titles in its group. */
+	runner = root;
+	do {
+		num++;
+		runner = runner->next;
+	} while (runner != root);
+
+	titles = (mptitle_t **) falloc(num, sizeof (mptitle_t *));
+	nextdup = (uint32_t *) falloc(num, sizeof (uint32_t));
+	names = hashInit(num);
+	for (uint32_t i = 0; i < num; i++) {
+		mphashentry_t *entry;
+		uint32_t key = strhash(runner->display);
+
+		titles[i] = runner;
+		nextdup[i] = num;
+		for (entry = hashFirst(names, key); entry != NULL;
+			 entry = hashNext(entry)) {
+			uint32_t last = (uint32_t) (uintptr_t) entry->data;
+
+			if (strcmp(titles[last]->display, runner->display) == 0) {
+				nextdup[last] = i;
+				entry->data = (void *) (uintptr_t) i;
+				break;
+			}
+		}
+		if (entry == NULL) {
+			hashAdd(names, key, (void *) (uintptr_t) i);
+		}
+		runner = runner->next;
+	}
+	names = hashWipe(names);
+
+	for (uint32_t i = 0; i + 1 < num; i++) {
+		currentEntry = titles[i];
+		for (uint32_t j = nextdup[i];
+			 (j < num) && !(currentEntry->flags & MP_MARK); j = nextdup[j]) {
+			runner = titles[j];
+			if (!(runner->flags & MP_MARK)) {
+				/* the titles identify the same, check their paths */
+				match = 0;
+				if (checkPath(runner, mpc_artist)) {
+					match |= 1;
 				}
-				if (currentEntry->flags & MP_MARK) {
-					runner = root;
+				if (checkPath(runner, mpc_album)) {
+					match |= 2;
 				}
-				else {
-					runner = runner->next;
+				if (checkPath(currentEntry, mpc_artist)) {
+					match |= 4;
 				}
-			} while (runner != root);
+				if (checkPath(currentEntry, mpc_album)) {
+					match |= 8;
+				}
+
+				switch (match) {
+				case 1:	/* 0001 */
+				case 2:	/* 0010 */
+				case 3:	/* 0011 */
+				case 7:	/* 0111 */
+				case 11:	/* 1011 */
+					/* runner is in an album, currentEntry in a mix */
+					handleDBL(currentEntry);
+					addMessage(1, "Marked %s", currentEntry->path);
+					fprintf(fp, "## Original at %s\n", runner->path);
+					fprintf(fp,
+							"rm \"%s\" >> %s/.mixplay/mixplay.dbl\n\n",
+							currentEntry->path, getenv("HOME"));
+					runner->flags |= MP_MARK;
+					count++;
+					break;
+				case 4:	/* 0100 */
+				case 8:	/* 1000 */
+				case 12:	/* 1100 */
+				case 13:	/* 1101 */
+				case 14:	/* 1110 */
+					/* currentEntry is in an album, runner in a mix */
+					handleDBL(runner);
+					addMessage(1, "Marked %s", runner->path);
+					fprintf(fp, "## Original at %s\n",
+							currentEntry->path);
+					fprintf(fp,
+							"rm \"%s\" >> %s/.mixplay/mixplay.dbl\n\n",
+							runner->path, getenv("HOME"));
+					currentEntry->flags |= MP_MARK;
+					count++;
+					break;
+				case 0:	/* 0000 */
+				case 5:	/* 0101 */
+				case 6:	/* 0110 */
+				case 9:	/* 1001 */
+				case 10:	/* 1010 */
+					/* both seem to be in a sampler/mix */
+					fprintf(fp, "## Uncertain match! Either:\n");
+					fprintf(fp, "#rm \"%s\"\n", currentEntry->path);
+					fprintf(fp,
+							"#echo \"%s\" >>  %s/.mixplay/mixplay.dbl\n",
+							currentEntry->path, getenv("HOME"));
+					fprintf(fp, "## Or:\n");
+					fprintf(fp, "#rm \"%s\"\n", runner->path);
+					fprintf(fp,
+							"#echo \"%s\" >>  %s/.mixplay/mixplay.dbl\n\n",
+							runner->path, getenv("HOME"));
+					runner->flags |= MP_MARK;	/* make sure only one of the doublets is used for future checkings */
+					qcnt++;
+					break;
+				case 15:	/* 1111 */
+					/* both titles are fine! */
+					break;
+				default:
+					addMessage(0, "Incorrect match: %i", match);
+					break;
+				}
+			}
 		}
-		currentEntry = currentEntry->next;
 	}
+	free(nextdup);
+	free(titles);
 
 	if (qcnt > 0) {
 		fprintf(fp, "echo \"Remember to clean the database!\"\n");
@@ -661,20 +2448,20 @@ int32_t dbNameCheck(void) {
 }
 
 /**
- * Creates a backup of the current database file and dumps the
- * current reindexed database in a new file
- *
- * if force is set, the database is written without checking the dbDirty
- * flag.
+ * takes a snapshot of the database and hands it to the writer thread.
+ * if wait is true, this returns once the file has been written.
+ * The titles get new keys, so this must be called with the catalogue
+ * locked!
  */
-void dbWrite(int32_t force) {
-	int32_t db;
-	uint32_t index = 1;
+static void dbFlush(int32_t force, bool wait) {
 	mptitle_t *root = getConfig()->root;
-	mptitle_t *runner = root;
+	dbsnap_t *snap;
 
 	if (!force && (getConfig()->dbDirty == 0)) {
 		addMessage(1, "No change in database.");
+		if (wait) {
+			dbWait();
+		}
 		return;
 	}
 
@@ -686,19 +2473,30 @@ void dbWrite(int32_t force) {
 		return;
 	}
 
-	fileBackup(getConfig()->dbname);
-	db = dbOpen();
-	if (db == -1) {
-		return;
+	/* the keys change with the snapshot */
+	pthread_rwlock_wrlock(&_idxlock);
+	snap = dbSnapshot(root);
+	if (_idxroot == root) {
+		dbIndexRekey(root);
 	}
-
-	do {
-		runner->key = index;
-		dbPutTitle(db, runner);
-		index++;
-		runner = runner->next;
+	else {
+		dbIndexBuild(root);
 	}
-	while (runner != root);
+	pthread_rwlock_unlock(&_idxlock);
 
-	dbClose(db);
+	dbQueue(snap, wait);
+}
+
+/**
+ * Creates a backup of the current database file and dumps the
+ * current reindexed database in a new file. Returns when the file
+ * has been written.
+ *
+ * if force is set, the database is written without checking the dbDirty
+ * flag.
+ */
+void dbWrite(int32_t force) {
+	lockCatalog();
+	dbFlush(force, true);
+	unlockCatalog();
 }
@@ -10,6 +10,7 @@
 #include "musicmgr.h"
 #include <assert.h>
 
+/* record of the original fixed size format */
 typedef struct {
 	char path[MAXPATHLEN];		/* path on the filesystem to the file */
 	char artist[NAMELEN];		/* Artist info */
@@ -20,18 +21,71 @@ typedef struct {
 	uint32_t skipcount;			/* skip counter */
 } dbentry_t;
 
+/* header of the current database format */
+#define DBMAGIC "MPDB"
+#define DBVERSION 3
+
+typedef struct {
+	char magic[4];				/* always DBMAGIC */
+	uint32_t version;			/* DBVERSION */
+	uint32_t count;				/* number of records */
+	uint32_t size;				/* size of the whole file */
+} dbheader_t;
+
+/* the header is followed by 'count' offsets to the records */
+typedef struct {
+	uint32_t playcount;			/* play counter */
+	uint32_t skipcount;			/* skip counter */
+	uint64_t size;				/* file size at the last scan */
+	int64_t mtime;				/* file modification time at the last scan */
+	uint64_t inode;				/* file inode at the last scan */
+	/* path, artist, title, album and genre as 16 bit length prefixed
+	 * strings, the record is padded to 64 bits */
+	uint8_t data[];
+} dbrecord_t;
+
+/* version 2 records only have the counts, the strings follow directly
+ * and the records are padded to 32 bits */
+#define DBR2SIZE (2 * sizeof(uint32_t))
+
+/* journal entry for changed counts */
+typedef struct {
+	uint32_t key;				/* key of the title */
+	uint32_t hash;				/* hash of the path to verify the title */
+	uint32_t playcount;			/* play counter */
+	uint32_t skipcount;			/* skip counter */
+} dbjournal_t;
+
 #define DBESIZE sizeof(dbentry_t)
+#define DBHSIZE sizeof(dbheader_t)
+#define DBRSIZE sizeof(dbrecord_t)
+#define JRNESIZE sizeof(dbjournal_t)
 #define ESIZE sizeof(mptitle_t)
 
 mptitle_t *dbGetMusic(void);
 int32_t dbCheckExist(void);
 int32_t dbAddTitles(char *basedir);
+bool dbFileUnchanged(const char *path, uint64_t size, int64_t mtime,
+					 uint64_t inode);
+int32_t dbUpdatePath(const char *path);
+int32_t dbRenamePath(const char *from, const char *to);
+int32_t dbRemovePath(const char *path);
 void dbWrite(int32_t);
 int32_t dbNameCheck(void);
 mptitle_t *getTitleByIndex(uint32_t index);
+mptitle_t *getTitleByPath(const char *path);
+mptitle_t *getTitleByName(const char *name);
+mptitle_t **getTitlesInDir(const char *dir);
+mptitle_t **dbFindTitles(const char *lopat, mptitle_t ** within);
+uint32_t dbGeneration(void);
+void dbSetRoot(mptitle_t * root);
+void dbIndexTitle(mptitle_t * title);
+void dbAppendTitle(mptitle_t * title);
+void dbLockTitles(void);
+void dbUnlockTitles(void);
 mptitle_t *getTitleForRange(const mpcmd_t range, const char *name);
 void dbMarkDirty(void);
+void dbUpdateCount(mptitle_t * title);
 int32_t mp3Exists(const mptitle_t * title);
-void dbAddPath(mptitle_t * title);
 
 #endif /* DATABASE_H_ */
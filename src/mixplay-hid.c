@@ -16,7 +16,7 @@ char last[MAXPATHLEN + 1] = "";
 static int32_t drawAll() {
 	jsonObject *jo = NULL;
 	char *text = NULL;
-	mptitle_t title;
+	mpcltitle_t title;
 	char current[MAXPATHLEN + 5];
 	int32_t state = 0;
 
@@ -32,6 +32,9 @@ var shortcuts = []
 var curvol = 0
 var inUpdate = 0
 var lastsearch = ''
+var lastsearchcmd = 0 /* mode of the last search to get the next page */
+var searchpage = false /* the next result is another page of the last search */
+var searchres = null /* all pages of the last search */
 var profiles = []
 var lineout = 0
 var allnum = 0
@@ -630,7 +633,13 @@ function sendCMDArg (cmd, arg) {
       break
     /* all these commands have a progress */
     case 0x13: /* mpc_search */
+      /* the next page keeps the current results */
+      if (cmd & 0x8000) {
+        searchpage = true
+        break
+      }
       lastsearch = arg
+      lastsearchcmd = cmd
       switchView(3)
       e = document.getElementById('search0')
       text = document.createElement('em')
@@ -1198,12 +1207,39 @@ function wipeElements (e) {
   }
 }
 
+/*
+ * returns a line that fetches the next page of the last search
+ */
+function moreResults (cursor) {
+  const more = document.createElement('p')
+  more.className = 'nopopselect'
+  more.innerHTML = '.. more results ..'
+  more.onclick = function () {
+    sendCMDArg(lastsearchcmd | 0x8000, cursor + '/' + lastsearch)
+  }
+  return more
+}
+
 function searchUpdate (data) {
   var items = []
   var choices = []
   var i
   var lineid = 2000
 
+  /* another page extends the results of the last search, unless the
+   * results changed and the server started over */
+  if (searchpage && (searchres !== null) && !data.restart) {
+    searchres.titles = searchres.titles.concat(data.titles)
+    searchres.artists = searchres.artists.concat(data.artists)
+    searchres.albums = searchres.albums.concat(data.albums)
+    searchres.albart = searchres.albart.concat(data.albart)
+    searchres.cursor = data.cursor
+    data = searchres
+  } else {
+    searchres = data
+  }
+  searchpage = false
+
   /* albums */
   var e = document.getElementById('search2')
   wipeElements(e)
@@ -1238,6 +1274,9 @@ function searchUpdate (data) {
     items[0] = document.createElement('em')
     items[0].innerHTML = 'No albums found!'
   }
+  if (data.cursor) {
+    items.push(moreResults(data.cursor))
+  }
   tabify(e, 'lres', items, 13)
 
   /* artists */
@@ -1274,6 +1313,9 @@ function searchUpdate (data) {
     items[0] = document.createElement('em')
     items[0].innerHTML = 'No artists found!'
   }
+  if (data.cursor) {
+    items.push(moreResults(data.cursor))
+  }
   tabify(e, 'ares', items, 13)
 
   /* titles */
@@ -1330,6 +1372,9 @@ function searchUpdate (data) {
     items[0] = document.createElement('em')
     items[0].innerHTML = 'Found ' + data.artists.length + ' artists and ' + data.albums.length + ' albums'
   }
+  if (data.cursor) {
+    items.push(moreResults(data.cursor))
+  }
   tabify(e, 'tres', items, 13)
 }
 
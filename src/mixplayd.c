@@ -23,6 +23,7 @@
 #include "mpinit.h"
 #include "mphid.h"
 #include "mpflirc.h"
+#include "mpwatch.h"
 #include "mpserver.h"
 #include "database.h"
 #include "mpalsa.h"				/* for getVolume */
@@ -96,7 +97,7 @@ static void _volumeUpdateHook() {
  * print title and play changes
  */
 static void _debugHidUpdateHook() {
-	char *title = NULL;
+	const char *title = NULL;
 
 	if ((getConfig()->current != NULL) &&
 		(getConfig()->current->title != NULL)) {
@@ -246,6 +247,11 @@ int32_t main(int32_t argc, char **argv) {
 			startFLIRC(hidfd);
 		}
 
+		/* follow changes in the musicdir */
+		if (getConfig()->watch) {
+			startWatcher();
+		}
+
 		if (getDebug()) {
 			addUpdateHook(&_debugHidUpdateHook);
 			pthread_create(&hidtid, NULL, debugHID, NULL);
@@ -292,7 +292,7 @@ jsonObject *getStatus(int32_t flags) {
 /*
  * helperfunction to fetch a title from the given jsonObject tree
  */
-int32_t jsonGetTitle(jsonObject * jo, const char *key, mptitle_t * title) {
+int32_t jsonGetTitle(jsonObject * jo, const char *key, mpcltitle_t * title) {
 	assert(title != NULL);
 	if (jsonPeek(jo, key) != json_object) {
 		title->key = 0;
@@ -14,6 +14,20 @@ int getConnection(void);
 int32_t sendCMD(mpcmd_t cmd, const char *arg);
 int32_t getCurrentTitle(char *title, uint32_t tlen);
 jsonObject *getStatus(int32_t flags);
-int32_t jsonGetTitle(jsonObject * jo, const char *key, mptitle_t * title);
+
+/* a title as the server sends it, clients keep their own copies */
+typedef struct {
+	uint32_t key;
+	uint32_t flags;
+	uint32_t playcount;
+	uint32_t skipcount;
+	char artist[NAMELEN];
+	char title[NAMELEN];
+	char album[NAMELEN];
+	char genre[NAMELEN];
+	char display[MAXPATHLEN];
+} mpcltitle_t;
+
+int32_t jsonGetTitle(jsonObject * jo, const char *key, mpcltitle_t * title);
 
 #endif
@@ -249,6 +249,8 @@ char *serializeStatus(int32_t clientid, int32_t type) {
 		jsonAddSres(jo, "artists", data->found->artists, data->found->anum);
 		jsonAddSres(jo, "albums", data->found->albums, data->found->lnum);
 		jsonAddSres(jo, "albart", data->found->albart, data->found->lnum);
+		jsonAddStr(jo, "cursor", data->found->cursor);
+		jsonAddBool(jo, "restart", data->found->restart);
 		/* Mark results as delivered */
 		data->found->cid = -1;
 	}
@@ -280,6 +282,7 @@ char *serializeStatus(int32_t clientid, int32_t type) {
 	jsonAddBool(jo, "mpfavplay", getFavplay());
 	jsonAddInt(jo, "clientid", clientid);
 	jsonAddInt(jo, "process", data->process);
+	jsonAddInt(jo, "throttle", data->throttle);
 	/* broadcast */
 
 	if (clientid > 0) {
@@ -1,7 +1,7 @@
 /*
  * mpgutils.c
  *
- * interface to libmpg123
+ * tag reading, libmpg123 is used as fallback
  *
  *  Created on: 04.10.2016
  *	  Author: bweber
@@ -12,9 +12,13 @@
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "utils.h"
 #include "mpgutils.h"
+#include "mpintern.h"
 
 /* default genres by number */
 static const char *const genres[192] = {
@@ -80,21 +84,410 @@ static size_t txtlen(const char *line) {
 	return (len - ret);
 }
 
+/**
+ * helperfunction to copy tag text
+ */
+static int32_t tagText(char *target, const char *text) {
+	if (txtlen(text) == 0) {
+		addMessage(3, ">%s< is only spaces!", text);
+		return 0;
+	}
+
+	strip(target, text, NAMELEN - 1);
+	return strlen(target);
+}
+
 /**
  * helperfunction to copy V2 tag data
  */
-static int32_t tagCopy(char *target, mpg123_string * tag) {
-	if (NULL == tag) {
+static void tagCopy(char *target, mpg123_string * tag) {
+	if ((NULL == tag) || (NULL == tag->p)) {
 		addMessage(3, "Empty Tag!");
-		return 0;
+		return;
+	}
+	strtcpy(target, tag->p, NAMELEN - 1);
+}
+
+/* tag data as found in the file, v2 texts are converted to UTF-8 */
+typedef struct {
+	bool v1;					/* ID3v1 trailer found */
+	char v1title[31];
+	char v1artist[31];
+	char v1album[31];
+	uint8_t v1genre;
+	bool v2;					/* ID3v2 tag with a title found */
+	char title[NAMELEN];
+	char artist[NAMELEN];
+	char album[NAMELEN];
+	char genre[NAMELEN];
+	size_t bytes;				/* data read from the file */
+} id3tag_t;
+
+/* the tags of a title while they are put together */
+typedef struct {
+	char artist[NAMELEN];
+	char title[NAMELEN];
+	char album[NAMELEN];
+	char genre[NAMELEN];
+} tagbuf_t;
+
+/* most of the time the text frames come first, so this is usually the
+ * only read needed for the v2 tag */
+#define ID3BUFF 4096
+/* text frames longer than this are cut */
+#define ID3TEXTMAX 1024
+
+/**
+ * decodes a 28 bit synchsafe integer
+ */
+static uint32_t id3Synchsafe(const uint8_t * b) {
+	return ((b[0] & 0x7f) << 21) | ((b[1] & 0x7f) << 14) |
+		((b[2] & 0x7f) << 7) | (b[3] & 0x7f);
+}
+
+/**
+ * appends the unicode codepoint cp to target as UTF-8
+ * returns the number of bytes added
+ */
+static size_t id3PutUTF8(char *target, size_t room, uint32_t cp) {
+	if ((cp < 0x80) && (room > 1)) {
+		target[0] = cp;
+		return 1;
+	}
+	if ((cp < 0x800) && (room > 2)) {
+		target[0] = 0xc0 | (cp >> 6);
+		target[1] = 0x80 | (cp & 0x3f);
+		return 2;
+	}
+	if ((cp < 0x10000) && (room > 3)) {
+		target[0] = 0xe0 | (cp >> 12);
+		target[1] = 0x80 | ((cp >> 6) & 0x3f);
+		target[2] = 0x80 | (cp & 0x3f);
+		return 3;
+	}
+	if ((cp >= 0x10000) && (room > 4)) {
+		target[0] = 0xf0 | (cp >> 18);
+		target[1] = 0x80 | ((cp >> 12) & 0x3f);
+		target[2] = 0x80 | ((cp >> 6) & 0x3f);
+		target[3] = 0x80 | (cp & 0x3f);
+		return 4;
+	}
+	return 0;
+}
+
+/**
+ * converts the text of a v2 text frame to UTF-8. Only the first string
+ * of the frame is used.
+ */
+static void id3Text(char *target, const uint8_t * data, size_t len) {
+	size_t pos = 0;
+	size_t i = 1;
+	bool bigendian = true;
+	uint8_t enc;
+
+	target[0] = 0;
+	if (len < 2) {
+		return;
+	}
+	enc = data[0];
+
+	switch (enc) {
+	case 0:					/* ISO-8859-1 */
+		while ((i < len) && (data[i] != 0)) {
+			size_t add = id3PutUTF8(target + pos, NAMELEN - pos, data[i]);
+
+			if (add == 0) {
+				break;
+			}
+			pos += add;
+			i++;
+		}
+		break;
+	case 1:					/* UTF-16 with BOM */
+	case 2:					/* UTF-16BE */
+		if ((enc == 1) && (len >= 3)) {
+			if ((data[1] == 0xff) && (data[2] == 0xfe)) {
+				bigendian = false;
+				i = 3;
+			}
+			else if ((data[1] == 0xfe) && (data[2] == 0xff)) {
+				i = 3;
+			}
+		}
+		while (i + 1 < len) {
+			uint32_t cp = bigendian ? (data[i] << 8) | data[i + 1] :
+				(data[i + 1] << 8) | data[i];
+			size_t add;
+
+			i += 2;
+			if (cp == 0) {
+				break;
+			}
+			/* surrogate pair */
+			if ((cp >= 0xd800) && (cp < 0xdc00) && (i + 1 < len)) {
+				uint32_t lo = bigendian ? (data[i] << 8) | data[i + 1] :
+					(data[i + 1] << 8) | data[i];
+
+				if ((lo >= 0xdc00) && (lo < 0xe000)) {
+					cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+					i += 2;
+				}
+			}
+			add = id3PutUTF8(target + pos, NAMELEN - pos, cp);
+			if (add == 0) {
+				break;
+			}
+			pos += add;
+		}
+		break;
+	case 3:					/* UTF-8 */
+		while ((i < len) && (data[i] != 0) && (pos < NAMELEN - 1)) {
+			target[pos++] = data[i++];
+		}
+		break;
+	default:
+		addMessage(1, "Unknown text encoding %i", enc);
+		break;
 	}
-	if (txtlen(tag->p) == 0) {
-		addMessage(3, ">%s< is only spaces!", tag->p);
+	target[pos] = 0;
+}
+
+/**
+ * reads the ID3v2 tag at the start of the file. Only the text frames
+ * are read, everything else is skipped.
+ * returns -1 if the tag cannot be handled here
+ */
+static int32_t id3ReadV2(int32_t fd, id3tag_t * tag) {
+	uint8_t buff[ID3BUFF];		/* file data from boff to bend */
+	uint8_t text[ID3TEXTMAX];
+	size_t boff = 0;
+	size_t bend;
+	ssize_t blen;
+	uint8_t version;
+	size_t end;
+	size_t pos = 10;
+	size_t hlen;				/* length of a frame header */
+	size_t idlen;				/* length of a frame ID */
+
+	blen = pread(fd, buff, ID3BUFF, 0);
+	if ((blen < 14) || memcmp(buff, "ID3", 3)) {
 		return 0;
 	}
+	bend = blen;
+	tag->bytes += blen;
 
-	strip(target, tag->p, NAMELEN - 1);
-	return strlen(target);
+	version = buff[3];
+	if ((version < 2) || (version > 4)) {
+		return -1;
+	}
+	/* unsynchronised tags are left to mpg123 */
+	if (buff[5] & 0x80) {
+		return -1;
+	}
+
+	end = 10 + id3Synchsafe(buff + 6);
+	hlen = (version == 2) ? 6 : 10;
+	idlen = (version == 2) ? 3 : 4;
+
+	/* skip the extended header */
+	if ((version > 2) && (buff[5] & 0x40)) {
+		if (version == 3) {
+			pos += 4 + ((buff[10] << 24) | (buff[11] << 16) |
+						(buff[12] << 8) | buff[13]);
+		}
+		else {
+			pos += id3Synchsafe(buff + 10);
+		}
+	}
+
+	while (pos + hlen <= end) {
+		const uint8_t *head;
+		uint32_t size;
+		char *target = NULL;
+		bool skip = false;
+
+		/* move the buffer if the frame header is not in it */
+		if (pos + hlen > bend) {
+			boff = pos;
+			blen = pread(fd, buff, ID3BUFF, boff);
+			if (blen < (ssize_t) hlen) {
+				break;
+			}
+			bend = boff + blen;
+			tag->bytes += blen;
+		}
+		head = buff + (pos - boff);
+
+		/* padding */
+		if (head[0] == 0) {
+			break;
+		}
+
+		if (version == 2) {
+			size = (head[3] << 16) | (head[4] << 8) | head[5];
+		}
+		else if (version == 3) {
+			size = (head[4] << 24) | (head[5] << 16) | (head[6] << 8) | head[7];
+			/* compressed or encrypted */
+			skip = (head[9] & 0xc0);
+		}
+		else {
+			size = id3Synchsafe(head + 4);
+			/* compressed, encrypted, unsynchronised or with length */
+			skip = (head[9] & 0x0f);
+		}
+
+		if (!memcmp(head, (version == 2) ? "TT2" : "TIT2", idlen)) {
+			target = tag->title;
+		}
+		else if (!memcmp(head, (version == 2) ? "TP1" : "TPE1", idlen)) {
+			target = tag->artist;
+		}
+		else if (!memcmp(head, (version == 2) ? "TAL" : "TALB", idlen)) {
+			target = tag->album;
+		}
+		else if (!memcmp(head, (version == 2) ? "TCO" : "TCON", idlen)) {
+			target = tag->genre;
+		}
+
+		if ((target != NULL) && !skip) {
+			size_t tlen = MIN(size, ID3TEXTMAX);
+			const uint8_t *data;
+
+			if (pos + hlen + tlen <= bend) {
+				data = buff + (pos + hlen - boff);
+			}
+			else if (pread(fd, text, tlen, pos + hlen) == (ssize_t) tlen) {
+				data = text;
+				tag->bytes += tlen;
+			}
+			else {
+				break;
+			}
+			id3Text(target, data, tlen);
+			/* a compressed or encrypted title does not count */
+			if (target == tag->title) {
+				tag->v2 = true;
+			}
+		}
+
+		pos += hlen + size;
+	}
+
+	return 0;
+}
+
+/**
+ * reads the ID3v1 trailer at the end of the file
+ */
+static void id3ReadV1(int32_t fd, id3tag_t * tag) {
+	uint8_t buff[128];
+	off_t size = lseek(fd, 0, SEEK_END);
+
+	if ((size < 128) || (pread(fd, buff, 128, size - 128) != 128) ||
+		memcmp(buff, "TAG", 3)) {
+		return;
+	}
+
+	tag->bytes += 128;
+	tag->v1 = true;
+	memcpy(tag->v1title, buff + 3, 30);
+	memcpy(tag->v1artist, buff + 33, 30);
+	memcpy(tag->v1album, buff + 63, 30);
+	tag->v1genre = buff[127];
+}
+
+/**
+ * reads the tags of the file without mpg123. This only reads the start
+ * and the end of the file.
+ * returns -1 if the file could not be read and 1 if mpg123 needs to take
+ * over.
+ */
+static int32_t id3Read(const char *path, id3tag_t * tag) {
+	int32_t fd = open(path, O_RDONLY);
+
+	if (fd == -1) {
+		return -1;
+	}
+
+	if (id3ReadV2(fd, tag) == -1) {
+		close(fd);
+		return 1;
+	}
+	id3ReadV1(fd, tag);
+	close(fd);
+
+	return 0;
+}
+
+/* libmpg123 must only be set up once, the scan workers read in parallel */
+static pthread_once_t _mpginit = PTHREAD_ONCE_INIT;
+
+/**
+ * sets up libmpg123 on the first read and tears it down when the
+ * process ends
+ */
+static void mpgInit(void) {
+	if (mpg123_init() != MPG123_OK) {
+		addMessage(0, "Could not initialize libmpg123!");
+		return;
+	}
+	atexit(mpg123_exit);
+}
+
+/**
+ * reads the tags with mpg123, this may decode a good part of the file
+ * returns -1 if the file could not be opened
+ */
+static int32_t mpgRead(const char *path, id3tag_t * tag) {
+	mpg123_handle *mh;
+	mpg123_id3v1 *v1;
+	mpg123_id3v2 *v2;
+	int32_t rv = 0;
+
+	pthread_once(&_mpginit, mpgInit);
+	mh = mpg123_new(NULL, NULL);
+	if (mh == NULL) {
+		addMessage(0, "Could not read tags from %s", path);
+		return -1;
+	}
+	mpg123_param(mh, MPG123_ADD_FLAGS, MPG123_QUIET, 0.0);
+
+	if (mpg123_open(mh, path) != MPG123_OK) {
+		rv = -1;
+	}
+	else {
+		while (mpg123_framebyframe_next(mh) == MPG123_OK) {
+			if (mpg123_meta_check(mh) & MPG123_ID3) {
+				addMessage(3, "Found ID3 tag");
+				break;
+			}
+		}
+
+		if (mpg123_id3(mh, &v1, &v2) == MPG123_OK) {
+			if ((v2 != NULL) && (v2->title != NULL)) {
+				tag->v2 = true;
+				tagCopy(tag->title, v2->title);
+				tagCopy(tag->artist, v2->artist);
+				tagCopy(tag->album, v2->album);
+				tagCopy(tag->genre, v2->genre);
+			}
+			if (v1 != NULL) {
+				tag->v1 = true;
+				memcpy(tag->v1title, v1->title, 30);
+				memcpy(tag->v1artist, v1->artist, 30);
+				memcpy(tag->v1album, v1->album, 30);
+				tag->v1genre = v1->genre;
+			}
+		}
+		else {
+			addMessage(0, "Tag parse error in %s", path);
+		}
+		mpg123_close(mh);
+	}
+
+	mpg123_delete(mh);
+	return rv;
 }
 
 /**
@@ -102,20 +495,20 @@ static int32_t tagCopy(char *target, mpg123_string * tag) {
  * Either it's Artist/Album for directories or just the Artist from an mp3
  * Used as base settings in case no mp3 tag info is available
  */
-static void genPathName(mptitle_t * entry) {
+static void genPathName(const char *path, tagbuf_t * entry) {
 	char *p;
 	char curdir[MAXPATHLEN];
 	int32_t blen = 0;
 
-	blen = strlen(entry->path);
+	blen = strlen(path);
 
 	/* trailing '/' should never happen! */
-	if (entry->path[blen] == '/') {
-		addMessage(0, "getPathName called with %s", entry->path);
+	if (path[blen] == '/') {
+		addMessage(0, "getPathName called with %s", path);
 		blen = blen - 1;
 	}
 
-	strtcpy(curdir, entry->path, MIN(blen + 1, MAXPATHLEN - 1));
+	strtcpy(curdir, path, MIN(blen + 1, MAXPATHLEN - 1));
 
 	/* cut off .mp3 */
 	if (endsWith(curdir, ".mp3")) {
@@ -154,101 +547,98 @@ static void genPathName(mptitle_t * entry) {
 
 /**
  * read tag data from the file
+ * returns the number of bytes read, data read by mpg123 is not counted
  * todo use the mpg123 provided text conversion functions
  */
-static void fillInfo(mpg123_handle * mh, mptitle_t * title) {
-	mpg123_id3v1 *v1;
-	mpg123_id3v2 *v2;
-	int32_t meta;
-	char path[MAXPATHLEN] = "";
+static size_t fillInfo(mptitle_t * title) {
+	id3tag_t tag;
+	tagbuf_t tags;
+	char path[MAXPATHLEN + 1] = "";
 	char *p, *b;
 	int32_t aisset = 0;
+	int32_t rv;
 
 	/* Set some default values as tag info may be incomplete */
-	genPathName(title);
+	memset(&tags, 0, sizeof (tags));
+	genPathName(title->path, &tags);
 
-	addMessage(2, "< %s:\n%s -%s\n%s", title->path, title->artist,
-			   title->title, title->album);
+	addMessage(2, "< %s:\n%s -%s\n%s", title->path, tags.artist,
+			   tags.title, tags.album);
 
-	strtcpy(path, fullpath(title->path), MAXPATHLEN - 1);
+	/* fullpath() is not thread safe */
+	if (title->path[0] == '/') {
+		strtcpy(path, title->path, MAXPATHLEN);
+	}
+	else {
+		snprintf(path, MAXPATHLEN, "%s%s", getConfig()->musicdir,
+				 title->path);
+	}
 
-	if (mpg123_open(mh, path) != MPG123_OK) {
+	memset(&tag, 0, sizeof (tag));
+	rv = id3Read(path, &tag);
+	if (rv == 1) {
+		addMessage(2, "Using mpg123 for %s", path);
+		memset(&tag, 0, sizeof (tag));
+		rv = mpgRead(path, &tag);
+	}
+	if (rv == -1) {
 		addMessage(1, "Could not open %s as MP3 file", path);
-		return;
+		internTags(title, tags.artist, tags.title, tags.album, tags.genre);
+		return 0;
 	}
 
-	while (mpg123_framebyframe_next(mh) == MPG123_OK) {
-		meta = mpg123_meta_check(mh);
-		if (meta & MPG123_ID3) {
-			addMessage(3, "Found ID3 tag");
-			break;
+	/* Prefer v2 tag data if available */
+	if (tag.v2) {
+		tagText(tags.title, tag.title);
+		if (tagText(tags.artist, tag.artist)) {
+			aisset = -1;
 		}
-	}
-
-	if (mpg123_id3(mh, &v1, &v2) == MPG123_OK) {
-		/* Prefer v2 tag data if available */
-		if ((v2 != NULL) && (v2->title != NULL)) {
-			tagCopy(title->title, v2->title);
-			if (tagCopy(title->artist, v2->artist)) {
-				aisset = -1;
-			}
-			tagCopy(title->album, v2->album);
+		tagText(tags.album, tag.album);
 
-			if (v2->genre) {
-				if ('(' == v2->genre->p[0]) {
-					strtcpy(title->genre, getGenre(atoi(&v2->genre->p[1])),
-							NAMELEN - 1);
-				}
-				else if ((v2->genre->p[0] == '0') || atoi(v2->genre->p) > 0) {
-					strtcpy(title->genre, getGenre(atoi(v2->genre->p)),
-							NAMELEN - 1);
-				}
-				else if (strlen(v2->genre->p) > 0) {
-					if (tagCopy(title->genre, v2->genre) == 1) {
-						addMessage(1, "%s is a genre? check %s", title->genre,
-								   title->path);
-					}
-				}
-				else {
-					strcpy(title->genre, "unset");
-				}
-			}
-			else {
-				strcpy(title->genre, "unset");
-			}
-			addMessage(3, "V2 %s/%s\n%s", title->artist, title->title,
-					   title->album);
+		if ('(' == tag.genre[0]) {
+			strtcpy(tags.genre, getGenre(atoi(&tag.genre[1])), NAMELEN - 1);
 		}
-		/* otherwise try v1 data */
-		else if (v1 != NULL) {
-			if (txtlen(v1->title) > 0) {
-				strip(title->title, v1->title, 32);
-			}
-
-			if (txtlen(v1->artist) > 1) {
-				strip(title->artist, v1->artist, 32);
-				aisset = -1;
-			}
-			if (txtlen(v1->album) > 1) {
-				strip(title->album, v1->album, 32);
+		else if ((tag.genre[0] == '0') || atoi(tag.genre) > 0) {
+			strtcpy(tags.genre, getGenre(atoi(tag.genre)), NAMELEN - 1);
+		}
+		else if (strlen(tag.genre) > 0) {
+			if (tagText(tags.genre, tag.genre) == 1) {
+				addMessage(1, "%s is a genre? check %s", tags.genre,
+						   title->path);
 			}
-			strtcpy(title->genre, getGenre(v1->genre), NAMELEN - 1);
-			addMessage(3, "V1 %s/%s\n%s", title->artist, title->title,
-					   title->album);
 		}
 		else {
-			addMessage(2, "No MP3 tag info for %s", title->title);
+			strcpy(tags.genre, "unset");
 		}
+		addMessage(3, "V2 %s/%s\n%s", tags.artist, tags.title,
+				   tags.album);
+	}
+	/* otherwise try v1 data */
+	else if (tag.v1) {
+		if (txtlen(tag.v1title) > 0) {
+			strip(tags.title, tag.v1title, 32);
+		}
+
+		if (txtlen(tag.v1artist) > 1) {
+			strip(tags.artist, tag.v1artist, 32);
+			aisset = -1;
+		}
+		if (txtlen(tag.v1album) > 1) {
+			strip(tags.album, tag.v1album, 32);
+		}
+		strtcpy(tags.genre, getGenre(tag.v1genre), NAMELEN - 1);
+		addMessage(3, "V1 %s/%s\n%s", tags.artist, tags.title,
+				   tags.album);
 	}
 	else {
-		addMessage(0, "Tag parse error in %s", title->path);
+		addMessage(2, "No MP3 tag info for %s", tags.title);
 	}
 
 	/* remove leading title title number first if any */
-	if ((strtol(title->title, &b, 10) != 0) &&
+	if ((strtol(tags.title, &b, 10) != 0) &&
 		((strstr(b, " - ") == b) || (strstr(b, " / ") == b))) {
-		addMessage(2, "Turning '%s' into '%s'", title->title, b + 3);
-		memmove(title->title, b + 3, strlen(b + 3) + 1);
+		addMessage(2, "Turning '%s' into '%s'", tags.title, b + 3);
+		memmove(tags.title, b + 3, strlen(b + 3) + 1);
 	}
 
 	/*
@@ -256,18 +646,18 @@ static void fillInfo(mpg123_handle * mh, mptitle_t * title) {
 	 * do not change artist if it has been set by and MP3 tag
 	 * remove leading numbers
 	 */
-	p = strstr(title->title, " - ");
+	p = strstr(tags.title, " - ");
 	if ((p != NULL) && !aisset) {
-		addMessage(2, "Splitting %s", title->title);
-		strtcpy(title->artist, title->title, NAMELEN - 1);
-		p = strstr(title->artist, " - ");
+		addMessage(2, "Splitting %s", tags.title);
+		strtcpy(tags.artist, tags.title, NAMELEN - 1);
+		p = strstr(tags.artist, " - ");
 		if (p != NULL) {
 			p[0] = 0;
-			strtcpy(title->title, p + 3, NAMELEN - 1);
+			strtcpy(tags.title, p + 3, NAMELEN - 1);
 		}
 		else {
 			addMessage(0, "String changed during strtcpy( %s, %s )!",
-					   title->artist, title->title);
+					   tags.artist, tags.title);
 		}
 	}
 
@@ -277,48 +667,37 @@ static void fillInfo(mpg123_handle * mh, mptitle_t * title) {
 	 * remove leading numbers
 	 */
 
-	p = strstr(title->title, " / ");
+	p = strstr(tags.title, " / ");
 	if ((p != NULL) && !aisset) {
-		addMessage(2, "Splitting %s", title->title);
-		strtcpy(title->artist, title->title, NAMELEN - 1);
-		p = strstr(title->artist, " / ");
+		addMessage(2, "Splitting %s", tags.title);
+		strtcpy(tags.artist, tags.title, NAMELEN - 1);
+		p = strstr(tags.artist, " / ");
 		if (p != NULL) {
 			p[0] = 0;
-			strtcpy(title->title, p + 3, NAMELEN - 1);
+			strtcpy(tags.title, p + 3, NAMELEN - 1);
 		}
 		else {
 			addMessage(0, "String changed during strtcpy( %s, %s )!",
-					   title->artist, title->title);
+					   tags.artist, tags.title);
 		}
 	}
 
-	assert(title->artist != NULL);
+	internTags(title, tags.artist, tags.title, tags.album, tags.genre);
 
-	strtcpy(title->display, title->artist, MAXPATHLEN - 1);
-	strtcat(title->display, " - ", MAXPATHLEN - 1);
-	strtcat(title->display, title->title, MAXPATHLEN - 1);
-
-	mpg123_close(mh);
-	addMessage(3, "> %s/%s\n%s", title->artist, title->title, title->album);
+	addMessage(3, "> %s/%s\n%s", tags.artist, tags.title, tags.album);
+	return tag.bytes;
 }
 
 /**
  * read tags for a single title
+ * returns the number of bytes read from the file
  */
 int32_t fillTagInfo(mptitle_t * title) {
-	mpg123_handle *mh;
-
 	/* Do not try to scan non mp3 files */
 	if (!isMusic(title->path)) {
 		addMessage(0, "%s is not an MP3 file!", title->path);
+		internTags(title, "", "", "", "");
 		return 0;
 	}
-	mpg123_init();
-	mh = mpg123_new(NULL, NULL);
-/*	mpg123_param( mh, MPG123_VERBOSE, 0, 0.0 ); */
-	mpg123_param(mh, MPG123_ADD_FLAGS, MPG123_QUIET, 0.0);
-	fillInfo(mh, title);
-	mpg123_delete(mh);
-	mpg123_exit();
-	return 0;
+	return fillInfo(title);
 }
@@ -0,0 +1,158 @@
+/**
+ * a minimal hash table to speed up lookups in the title list
+ */
+#include <ctype.h>
+
+#include "mphash.h"
+#include "utils.h"
+
+/**
+ * creates a new hash with at least 'size' buckets
+ */
+mphash_t *hashInit(uint32_t size) {
+	mphash_t *hash = (mphash_t *) falloc(1, sizeof (mphash_t));
+
+	hash->size = 64;
+	while (hash->size < size) {
+		hash->size <<= 1;
+	}
+	hash->count = 0;
+	hash->bucket =
+		(mphashentry_t **) falloc(hash->size, sizeof (mphashentry_t *));
+	return hash;
+}
+
+/**
+ * frees the hash and all entries, the payload is left untouched.
+ * returns NULL for intuitive calling
+ */
+mphash_t *hashWipe(mphash_t * hash) {
+	mphashentry_t *entry;
+
+	if (hash == NULL) {
+		return NULL;
+	}
+
+	for (uint32_t i = 0; i < hash->size; i++) {
+		while (hash->bucket[i] != NULL) {
+			entry = hash->bucket[i];
+			hash->bucket[i] = entry->next;
+			free(entry);
+		}
+	}
+	free(hash->bucket);
+	free(hash);
+	return NULL;
+}
+
+/**
+ * doubles the number of buckets and redistributes the entries
+ */
+static void hashGrow(mphash_t * hash) {
+	uint32_t size = hash->size << 1;
+	mphashentry_t **bucket =
+		(mphashentry_t **) falloc(size, sizeof (mphashentry_t *));
+	mphashentry_t *entry;
+
+	for (uint32_t i = 0; i < hash->size; i++) {
+		while (hash->bucket[i] != NULL) {
+			entry = hash->bucket[i];
+			hash->bucket[i] = entry->next;
+			entry->next = bucket[entry->key & (size - 1)];
+			bucket[entry->key & (size - 1)] = entry;
+		}
+	}
+	free(hash->bucket);
+	hash->bucket = bucket;
+	hash->size = size;
+}
+
+/**
+ * adds data with the given key. Does not check for doublets!
+ */
+void hashAdd(mphash_t * hash, uint32_t key, void *data) {
+	mphashentry_t *entry =
+		(mphashentry_t *) falloc(1, sizeof (mphashentry_t));
+
+	if (hash->count > 2 * hash->size) {
+		hashGrow(hash);
+	}
+
+	entry->key = key;
+	entry->data = data;
+	entry->next = hash->bucket[key & (hash->size - 1)];
+	hash->bucket[key & (hash->size - 1)] = entry;
+	hash->count++;
+}
+
+/**
+ * removes the entry with the given key and data.
+ * returns true if the entry was found
+ */
+bool hashDel(mphash_t * hash, uint32_t key, const void *data) {
+	mphashentry_t **pos = &(hash->bucket[key & (hash->size - 1)]);
+	mphashentry_t *entry;
+
+	while (*pos != NULL) {
+		entry = *pos;
+		if ((entry->key == key) && (entry->data == data)) {
+			*pos = entry->next;
+			free(entry);
+			hash->count--;
+			return true;
+		}
+		pos = &(entry->next);
+	}
+	return false;
+}
+
+/**
+ * returns the first entry with the given key or NULL
+ */
+mphashentry_t *hashFirst(const mphash_t * hash, uint32_t key) {
+	mphashentry_t *entry = hash->bucket[key & (hash->size - 1)];
+
+	while ((entry != NULL) && (entry->key != key)) {
+		entry = entry->next;
+	}
+	return entry;
+}
+
+/**
+ * returns the next entry with the same key as entry or NULL
+ */
+mphashentry_t *hashNext(const mphashentry_t * entry) {
+	uint32_t key = entry->key;
+
+	entry = entry->next;
+	while ((entry != NULL) && (entry->key != key)) {
+		entry = entry->next;
+	}
+	return (mphashentry_t *) entry;
+}
+
+/**
+ * FNV-1a hash of a string
+ */
+uint32_t strhash(const char *text) {
+	uint32_t hash = 2166136261u;
+
+	while (*text != '\0') {
+		hash ^= (uint8_t) * text++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * case insensitive FNV-1a hash of a string
+ */
+uint32_t strihash(const char *text) {
+	uint32_t hash = 2166136261u;
+
+	while (*text != '\0') {
+		hash ^= (uint8_t) tolower(*text++);
+		hash *= 16777619u;
+	}
+	return hash;
+}
@@ -0,0 +1,31 @@
+#ifndef __MPHASH_H__
+#define __MPHASH_H__ 1
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * simple chained hash, entries with the same key are kept and the
+ * caller decides which one fits
+ */
+typedef struct mphashentry_s mphashentry_t;
+struct mphashentry_s {
+	uint32_t key;				/* hash value of the entry */
+	void *data;					/* the actual payload */
+	mphashentry_t *next;		/* next entry in the bucket */
+};
+
+typedef struct {
+	uint32_t size;				/* number of buckets, always a power of two */
+	uint32_t count;				/* number of entries */
+	mphashentry_t **bucket;
+} mphash_t;
+
+mphash_t *hashInit(uint32_t size);
+mphash_t *hashWipe(mphash_t * hash);
+void hashAdd(mphash_t * hash, uint32_t key, void *data);
+bool hashDel(mphash_t * hash, uint32_t key, const void *data);
+mphashentry_t *hashFirst(const mphash_t * hash, uint32_t key);
+mphashentry_t *hashNext(const mphashentry_t * entry);
+uint32_t strhash(const char *text);
+uint32_t strihash(const char *text);
+#endif
@@ -0,0 +1,232 @@
+/**
+ * interned strings to replace string compares by ID compares and the
+ * strings of the titles
+ */
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include "mpintern.h"
+#include "mphash.h"
+#include "utils.h"
+
+static mphash_t *_pool = NULL;
+static char **_strings = NULL;
+static char **_lostrings = NULL;	/* the strings prepared by patPrep() */
+static uint32_t _num = 0;
+/* the tags as they are, the titles share them */
+static mphash_t *_tags = NULL;
+static pthread_mutex_t _poollock = PTHREAD_MUTEX_INITIALIZER;
+
+/* strings a title keeps until it is freed itself */
+struct mpowned_s {
+	char *text;
+	mpowned_t *next;
+};
+
+/**
+ * returns the ID of text or 0 if text is not in the pool.
+ * must be called with the pool locked!
+ */
+static uint32_t poolFind(const char *text, uint32_t hash) {
+	mphashentry_t *entry;
+
+	if (_pool == NULL) {
+		return 0;
+	}
+
+	for (entry = hashFirst(_pool, hash); entry != NULL;
+		 entry = hashNext(entry)) {
+		uint32_t id = (uint32_t) (uintptr_t) entry->data;
+
+		if (strcasecmp(_strings[id - 1], text) == 0) {
+			return id;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * returns the ID of the given string, unknown strings are added
+ */
+uint32_t internId(const char *text) {
+	char lotext[MAXPATHLEN + 1];
+	uint32_t hash = strihash(text);
+	uint32_t id;
+
+	pthread_mutex_lock(&_poollock);
+	id = poolFind(text, hash);
+	if (id == 0) {
+		if (_pool == NULL) {
+			_pool = hashInit(1024);
+		}
+		_strings = (char **) frealloc(_strings, (_num + 1) * sizeof (char *));
+		_strings[_num] = strdup(text);
+		_lostrings = (char **) frealloc(_lostrings,
+										(_num + 1) * sizeof (char *));
+		patPrep(lotext, text, MAXPATHLEN);
+		_lostrings[_num] = strdup(lotext);
+		_num++;
+		id = _num;
+		hashAdd(_pool, hash, (void *) (uintptr_t) id);
+	}
+	pthread_mutex_unlock(&_poollock);
+
+	return id;
+}
+
+/**
+ * returns the ID of the given string or 0 if it is not in the pool
+ */
+uint32_t internFind(const char *text) {
+	uint32_t id;
+
+	pthread_mutex_lock(&_poollock);
+	id = poolFind(text, strihash(text));
+	pthread_mutex_unlock(&_poollock);
+
+	return id;
+}
+
+/**
+ * returns the string with the given ID as prepared by patPrep().
+ * Strings are never removed from the pool, so this stays valid.
+ */
+static const char *internPat(uint32_t id) {
+	const char *pat;
+
+	pthread_mutex_lock(&_poollock);
+	pat = _lostrings[id - 1];
+	pthread_mutex_unlock(&_poollock);
+
+	return pat;
+}
+
+/**
+ * returns the shared copy of the tag text. Unlike the IDs this keeps the
+ * case. Tags are never removed, so this stays valid.
+ */
+const char *internTag(const char *text) {
+	uint32_t hash = strhash(text);
+	mphashentry_t *entry;
+	char *tag = NULL;
+
+	pthread_mutex_lock(&_poollock);
+	if (_tags == NULL) {
+		_tags = hashInit(1024);
+	}
+	for (entry = hashFirst(_tags, hash); entry != NULL;
+		 entry = hashNext(entry)) {
+		if (strcmp((char *) entry->data, text) == 0) {
+			tag = (char *) entry->data;
+			break;
+		}
+	}
+	if (tag == NULL) {
+		tag = strdup(text);
+		hashAdd(_tags, hash, tag);
+	}
+	pthread_mutex_unlock(&_poollock);
+
+	return tag;
+}
+
+/**
+ * hands a string over to the title, it is freed together with the title.
+ * Other threads may still read a string that has just been replaced, but
+ * only as long as they can reach the title, so this is safe without a
+ * lock on every reader.
+ */
+static void internKeep(mptitle_t * title, const char *text) {
+	mpowned_t *owned;
+
+	if (text == NULL) {
+		return;
+	}
+
+	owned = (mpowned_t *) falloc(1, sizeof (mpowned_t));
+	owned->text = (char *) text;
+	owned->next = title->owned;
+	title->owned = owned;
+}
+
+/**
+ * sets a string that belongs to a title to a copy of value, the old
+ * string is kept until the title is freed. Rescans set the same strings
+ * again and again, so an unchanged string is kept as it is.
+ */
+void internText(mptitle_t * title, const char **text, const char *value) {
+	if ((*text != NULL) && (strcmp(*text, value) == 0)) {
+		return;
+	}
+	internKeep(title, *text);
+	*text = strdup(value);
+}
+
+/**
+ * sets a tag of a title to a copy that belongs to the title instead of
+ * the shared pool. For transient titles like stream entries, that would
+ * otherwise add every new stream title to the pool for good.
+ */
+void internOwn(mptitle_t * title, const char **tag, const char *value) {
+	if ((*tag != NULL) && (strcmp(*tag, value) == 0)) {
+		return;
+	}
+	*tag = strdup(value);
+	internKeep(title, *tag);
+}
+
+/**
+ * sets the tags of a title and the display name made of them. The IDs
+ * and search keys still need to be set with internTitle().
+ */
+void internTags(mptitle_t * title, const char *artist, const char *name,
+				const char *album, const char *genre) {
+	char display[MAXPATHLEN];
+
+	snprintf(display, MAXPATHLEN, "%s - %s", artist, name);
+	title->artist = internTag(artist);
+	title->album = internTag(album);
+	title->genre = internTag(genre);
+	internText(title, &title->title, name);
+	internText(title, &title->display, display);
+}
+
+/**
+ * frees the strings that belong to the title, the shared tags stay
+ */
+void internFree(mptitle_t * title) {
+	mpowned_t *owned;
+
+	free((char *) title->path);
+	free((char *) title->title);
+	free((char *) title->display);
+	free((char *) title->lotitle);
+	free((char *) title->lodisplay);
+	while (title->owned != NULL) {
+		owned = title->owned;
+		title->owned = owned->next;
+		free(owned->text);
+		free(owned);
+	}
+}
+
+/**
+ * sets the artist, album and genre IDs and the search keys of a title.
+ * Needs to be called whenever the tags change.
+ */
+void internTitle(mptitle_t * title) {
+	char lotext[MAXPATHLEN + 1];
+
+	title->artistid = internId(title->artist);
+	title->albumid = internId(title->album);
+	title->genreid = internId(title->genre);
+	title->loartist = internPat(title->artistid);
+	title->loalbum = internPat(title->albumid);
+	patPrep(lotext, title->title, MAXPATHLEN);
+	internText(title, &title->lotitle, lotext);
+	patPrep(lotext, title->display, MAXPATHLEN);
+	internText(title, &title->lodisplay, lotext);
+}
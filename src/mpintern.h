@@ -0,0 +1,25 @@
+#ifndef __MPINTERN_H__
+#define __MPINTERN_H__ 1
+#include <stdint.h>
+#include "musicmgr.h"
+
+/*
+ * case insensitive string pool. Equal strings get the same ID, so
+ * comparing artists, albums or genres becomes an integer compare.
+ * ID 0 is never used and marks strings that are not in the pool.
+ *
+ * The strings of the titles are set here too. Tags are shared between
+ * the titles and never freed, the path, title, display and search keys
+ * belong to the title and are freed with it. Replaced strings are kept
+ * until then, as other threads may still read them.
+ */
+uint32_t internId(const char *text);
+uint32_t internFind(const char *text);
+const char *internTag(const char *text);
+void internText(mptitle_t * title, const char **text, const char *value);
+void internOwn(mptitle_t * title, const char **tag, const char *value);
+void internTags(mptitle_t * title, const char *artist, const char *name,
+				const char *album, const char *genre);
+void internFree(mptitle_t * title);
+void internTitle(mptitle_t * title);
+#endif
@@ -0,0 +1,164 @@
+/**
+ * priorities and rate limits for background jobs
+ */
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "mpthrottle.h"
+#include "config.h"
+#include "utils.h"
+
+/* there is no glibc wrapper for ioprio_set() */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_IDLE (IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT)
+
+/* the rates are measured over this many ms */
+#define THROTTLEWINDOW 5000
+
+/* I/O priority of the thread before the job */
+static __thread int32_t _ioprio = -1;
+
+static uint32_t _jobs = 0;		/* running background jobs */
+static uint32_t _waiting = 0;	/* jobs waiting for the rate limit */
+static struct timespec _start;	/* start of the current window */
+static uint64_t _files = 0;		/* files in the current window */
+static uint64_t _bytes = 0;		/* bytes in the current window */
+static pthread_mutex_t _thlock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * returns the ms since the start of the current window
+ */
+static uint64_t throttleAge(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - _start.tv_sec) * 1000 +
+		(now.tv_nsec - _start.tv_nsec) / 1000000;
+}
+
+/**
+ * publishes the throttle state in the status, must be called with
+ * _thlock held!
+ */
+static void throttleState(void) {
+	uint32_t state = THROTTLE_OFF;
+
+	if (_waiting > 0) {
+		state = THROTTLE_LIMIT;
+	}
+	else if (_jobs > 0) {
+		state = THROTTLE_IDLE;
+	}
+
+	if (getConfig()->throttle != state) {
+		getConfig()->throttle = state;
+		notifyChange(MPCOMM_STAT);
+	}
+}
+
+/**
+ * puts the calling thread into the idle I/O class and to the lowest CPU
+ * priority. Threads started by a job inherit this. An unprivileged
+ * thread cannot raise its CPU priority again, so this must only be
+ * called on threads that end with the job, like the asyncRun() jobs.
+ */
+void throttleStart(void) {
+	pid_t tid = gettid();
+
+	_ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, tid);
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_IDLE) == -1) {
+		addMessage(1, "Could not set I/O priority: %s", strerror(errno));
+	}
+	if (setpriority(PRIO_PROCESS, tid, 19) == -1) {
+		addMessage(1, "Could not set priority: %s", strerror(errno));
+	}
+
+	pthread_mutex_lock(&_thlock);
+	if (_jobs++ == 0) {
+		_files = 0;
+		_bytes = 0;
+		clock_gettime(CLOCK_MONOTONIC, &_start);
+	}
+	throttleState();
+	pthread_mutex_unlock(&_thlock);
+}
+
+/**
+ * ends a background job, the I/O priority is restored, the CPU priority
+ * is not.
+ */
+void throttleEnd(void) {
+	if (_ioprio != -1) {
+		syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, gettid(), _ioprio);
+		_ioprio = -1;
+	}
+
+	pthread_mutex_lock(&_thlock);
+	if (_jobs > 0) {
+		_jobs--;
+	}
+	throttleState();
+	pthread_mutex_unlock(&_thlock);
+}
+
+/**
+ * accounts for files and bytes that a job has read and waits if it is
+ * faster than the configured scanfps and scanmbps. Without a background
+ * job nothing is limited.
+ */
+void throttle(uint32_t files, uint64_t bytes) {
+	mpconfig_t *config = getConfig();
+	uint64_t due = 0;
+	uint64_t age;
+
+	if ((config->scanfps == 0) && (config->scanmbps == 0)) {
+		return;
+	}
+
+	pthread_mutex_lock(&_thlock);
+	if (_jobs == 0) {
+		pthread_mutex_unlock(&_thlock);
+		return;
+	}
+
+	/* start a new window, so a pause does not allow a burst */
+	age = throttleAge();
+	if (age > THROTTLEWINDOW) {
+		_files = 0;
+		_bytes = 0;
+		clock_gettime(CLOCK_MONOTONIC, &_start);
+		age = 0;
+	}
+	_files += files;
+	_bytes += bytes;
+
+	/* when should the window be at this point? */
+	if (config->scanfps > 0) {
+		due = (_files * 1000) / config->scanfps;
+	}
+	if (config->scanmbps > 0) {
+		due = MAX(due, (_bytes * 1000) / (config->scanmbps * 1024 * 1024));
+	}
+
+	if (due <= age) {
+		pthread_mutex_unlock(&_thlock);
+		return;
+	}
+	_waiting++;
+	throttleState();
+	pthread_mutex_unlock(&_thlock);
+
+	usleep((due - age) * 1000);
+
+	pthread_mutex_lock(&_thlock);
+	_waiting--;
+	throttleState();
+	pthread_mutex_unlock(&_thlock);
+}
@@ -0,0 +1,19 @@
+#ifndef __MPTHROTTLE_H__
+#define __MPTHROTTLE_H__ 1
+#include <stdint.h>
+
+/*
+ * keeps scans and other maintenance jobs from getting in the way of
+ * the player
+ */
+
+/* throttle states in the status */
+#define THROTTLE_OFF 0			/* no background job */
+#define THROTTLE_IDLE 1			/* background job with idle priority */
+#define THROTTLE_LIMIT 2		/* background job waits for the rate limit */
+
+void throttleStart(void);
+void throttleEnd(void);
+void throttle(uint32_t files, uint64_t bytes);
+
+#endif
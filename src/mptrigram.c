@@ -0,0 +1,241 @@
+/**
+ * trigram index to preselect search candidates
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "mptrigram.h"
+#include "utils.h"
+
+/* the IDs that contain one trigram in the order they were added */
+typedef struct {
+	uint32_t *ids;
+	uint32_t num;
+} mptrilist_t;
+
+/**
+ * turns the three characters at text into a hash key. The mixing is
+ * reversible, so every trigram gets its own key.
+ */
+static uint32_t trigramKey(const char *text) {
+	uint32_t key = ((uint32_t) (uint8_t) text[0] << 16) |
+		((uint32_t) (uint8_t) text[1] << 8) | (uint8_t) text[2];
+
+	key ^= key >> 16;
+	key *= 0x85ebca6b;
+	key ^= key >> 13;
+	key *= 0xc2b2ae35;
+	key ^= key >> 16;
+	return key;
+}
+
+/**
+ * returns the list of the trigram with the given key or NULL
+ */
+static mptrilist_t *trigramList(const mptrigram_t * index, uint32_t key) {
+	mphashentry_t *entry = hashFirst(index->lists, key);
+
+	return (entry == NULL) ? NULL : (mptrilist_t *) entry->data;
+}
+
+/**
+ * creates an empty index for about size trigrams
+ */
+mptrigram_t *trigramInit(uint32_t size) {
+	mptrigram_t *index = (mptrigram_t *) falloc(1, sizeof (mptrigram_t));
+
+	index->lists = hashInit(size);
+	index->maxid = 0;
+	return index;
+}
+
+/**
+ * frees the index, returns NULL for intuitive calling
+ */
+mptrigram_t *trigramWipe(mptrigram_t * index) {
+	mphashentry_t *entry;
+
+	if (index == NULL) {
+		return NULL;
+	}
+
+	for (uint32_t i = 0; i < index->lists->size; i++) {
+		for (entry = index->lists->bucket[i]; entry != NULL;
+			 entry = entry->next) {
+			mptrilist_t *list = (mptrilist_t *) entry->data;
+
+			free(list->ids);
+			free(list);
+		}
+	}
+	hashWipe(index->lists);
+	free(index);
+	return NULL;
+}
+
+/**
+ * copies a text with one or two characters into a trigram padded with 0.
+ * No real trigram contains a 0, so the short texts get keys of their own.
+ */
+static const char *trigramShort(char tri[3], const char *lotext) {
+	tri[0] = lotext[0];
+	tri[1] = lotext[1];
+	tri[2] = 0;
+	return tri;
+}
+
+/**
+ * adds all trigrams of the prepared text for id. The texts of one ID
+ * should be added in one go, so a trigram that shows up twice is only
+ * stored once. A text with one or two characters is stored as a single
+ * padded trigram.
+ */
+void trigramAdd(mptrigram_t * index, uint32_t id, const char *lotext) {
+	size_t len = strlen(lotext);
+	mptrilist_t *list;
+	uint32_t key;
+	char tri[3];
+
+	for (size_t i = 0; (i + 3 <= len) || ((i == 0) && (len > 0)); i++) {
+		key = trigramKey((len < 3) ? trigramShort(tri, lotext) : lotext + i);
+		list = trigramList(index, key);
+		if (list == NULL) {
+			list = (mptrilist_t *) falloc(1, sizeof (mptrilist_t));
+			hashAdd(index->lists, key, list);
+		}
+		else if ((list->num > 0) && (list->ids[list->num - 1] == id)) {
+			continue;
+		}
+
+		/* grow in powers of two */
+		if ((list->num & (list->num - 1)) == 0) {
+			list->ids = (uint32_t *) frealloc(list->ids,
+											  (list->num ? list->num * 2 : 1)
+											  * sizeof (uint32_t));
+		}
+		list->ids[list->num++] = id;
+	}
+
+	index->maxid = MAX(index->maxid, id);
+}
+
+/**
+ * replaces every ID with map[ID]. IDs that map to 0 or are not in the map
+ * are dropped.
+ */
+void trigramRemap(mptrigram_t * index, const uint32_t * map, uint32_t len) {
+	mphashentry_t *entry;
+	uint32_t num;
+
+	index->maxid = 0;
+	for (uint32_t i = 0; i < index->lists->size; i++) {
+		for (entry = index->lists->bucket[i]; entry != NULL;
+			 entry = entry->next) {
+			mptrilist_t *list = (mptrilist_t *) entry->data;
+
+			num = 0;
+			for (uint32_t j = 0; j < list->num; j++) {
+				uint32_t id = list->ids[j];
+
+				if ((id < len) && (map[id] != 0)) {
+					list->ids[num++] = map[id];
+					index->maxid = MAX(index->maxid, map[id]);
+				}
+			}
+			list->num = num;
+		}
+	}
+}
+
+/**
+ * returns the number of different trigrams in the prepared pattern
+ */
+uint32_t trigramNum(const char *lopat) {
+	size_t len = strlen(lopat);
+	uint32_t num = 0;
+
+	for (size_t i = 0; i + 3 <= len; i++) {
+		size_t j = 0;
+
+		while ((j < i) && strncmp(lopat + j, lopat + i, 3)) {
+			j++;
+		}
+		if (j == i) {
+			num++;
+		}
+	}
+	return num;
+}
+
+static int32_t hitsort(const void *a, const void *b) {
+	const mptrihit_t *ha = (const mptrihit_t *) a;
+	const mptrihit_t *hb = (const mptrihit_t *) b;
+
+	return (ha->id > hb->id) - (ha->id < hb->id);
+}
+
+/**
+ * finds all IDs that share at least one trigram with the prepared
+ * pattern. hits will be set to a list of the IDs and the number of
+ * different pattern trigrams each of them has, ordered by ID.
+ * A pattern with one or two characters finds the IDs that have exactly
+ * this text.
+ * The list must be freed by the caller.
+ * returns the number of entries in hits
+ */
+uint32_t trigramFind(const mptrigram_t * index, const char *lopat,
+					 mptrihit_t ** hits) {
+	size_t len = strlen(lopat);
+	uint8_t *count = (uint8_t *) falloc(index->maxid + 1, sizeof (uint8_t));
+	uint32_t *ids = NULL;
+	uint32_t num = 0;
+	mptrilist_t *list;
+	char tri[3];
+
+	for (size_t i = 0; (i + 3 <= len) || ((i == 0) && (len > 0)); i++) {
+		size_t j = 0;
+
+		if (len < 3) {
+			list = trigramList(index, trigramKey(trigramShort(tri, lopat)));
+		}
+		else {
+			/* count every pattern trigram just once */
+			while ((j < i) && strncmp(lopat + j, lopat + i, 3)) {
+				j++;
+			}
+			if (j < i) {
+				continue;
+			}
+			list = trigramList(index, trigramKey(lopat + i));
+		}
+		if (list == NULL) {
+			continue;
+		}
+
+		for (uint32_t k = 0; k < list->num; k++) {
+			uint32_t id = list->ids[k];
+
+			if (count[id] == UINT8_MAX) {
+				continue;
+			}
+			if (count[id]++ == 0) {
+				if ((num & (num - 1)) == 0) {
+					ids = (uint32_t *) frealloc(ids, (num ? num * 2 : 1) *
+												sizeof (uint32_t));
+				}
+				ids[num++] = id;
+			}
+		}
+	}
+
+	*hits = (mptrihit_t *) falloc(num + 1, sizeof (mptrihit_t));
+	for (uint32_t i = 0; i < num; i++) {
+		(*hits)[i].id = ids[i];
+		(*hits)[i].hits = count[ids[i]];
+	}
+	qsort(*hits, num, sizeof (mptrihit_t), hitsort);
+
+	free(ids);
+	free(count);
+	return num;
+}
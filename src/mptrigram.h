@@ -0,0 +1,29 @@
+#ifndef __MPTRIGRAM_H__
+#define __MPTRIGRAM_H__ 1
+#include <stdint.h>
+#include "mphash.h"
+
+/*
+ * inverted index from the trigrams of prepared strings to the IDs of
+ * their owners. Used to find search candidates without looking at every
+ * title.
+ */
+typedef struct {
+	mphash_t *lists;			/* trigram -> mptrilist_t */
+	uint32_t maxid;				/* highest ID in the index */
+} mptrigram_t;
+
+/* an ID and the number of pattern trigrams it has */
+typedef struct {
+	uint32_t id;
+	uint32_t hits;
+} mptrihit_t;
+
+mptrigram_t *trigramInit(uint32_t size);
+mptrigram_t *trigramWipe(mptrigram_t * index);
+void trigramAdd(mptrigram_t * index, uint32_t id, const char *lotext);
+void trigramRemap(mptrigram_t * index, const uint32_t * map, uint32_t len);
+uint32_t trigramNum(const char *lopat);
+uint32_t trigramFind(const mptrigram_t * index, const char *lopat,
+					 mptrihit_t ** hits);
+#endif
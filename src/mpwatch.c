@@ -0,0 +1,424 @@
+/**
+ * keeps the database in sync with the musicdir
+ */
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#include "mpwatch.h"
+#include "database.h"
+#include "controller.h"
+#include "mpthrottle.h"
+#include "utils.h"
+
+/* changes are applied once the musicdir has been quiet for WATCHDELAY ms
+ * but at the latest after WATCHMAX ms */
+#define WATCHDELAY 2000
+#define WATCHMAX 20000
+
+#define WATCHMASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+	IN_MOVED_TO | IN_ONLYDIR)
+
+typedef enum {
+	watch_update,
+	watch_move,
+	watch_remove
+} watchop_t;
+
+/* a change that waits to be applied */
+typedef struct {
+	watchop_t op;
+	char *path;
+	char *to;					/* target of a move */
+	uint32_t cookie;			/* pairs the two halves of a move */
+} watchevent_t;
+
+static int32_t _wfd = -1;
+/* watched directories by watch descriptor */
+static char **_wpaths = NULL;
+static int32_t _wnum = 0;
+/* pending changes in the order they happened */
+static watchevent_t *_wevents = NULL;
+static uint32_t _wevnum = 0;
+static bool _woverflow = false;
+static struct timespec _wfirst;
+
+/**
+ * returns the milliseconds since the first pending change
+ */
+static uint64_t watchAge(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - _wfirst.tv_sec) * 1000 +
+		(now.tv_nsec - _wfirst.tv_nsec) / 1000000;
+}
+
+/**
+ * watches path and all subdirectories. If add is set, the music files in
+ * there are added to the database.
+ * returns the number of changed titles
+ */
+static int32_t watchTree(const char *path, bool add) {
+	char sub[MAXPATHLEN];
+	struct dirent *de;
+	DIR *dir;
+	int32_t wd;
+	int32_t num = 0;
+
+	wd = inotify_add_watch(_wfd, path, WATCHMASK);
+	if (wd == -1) {
+		addMessage(0, "Could not watch %s: %s", path, strerror(errno));
+		return 0;
+	}
+	if (wd >= _wnum) {
+		_wpaths = (char **) frealloc(_wpaths, (wd + 1) * sizeof (char *));
+		memset(_wpaths + _wnum, 0, (wd + 1 - _wnum) * sizeof (char *));
+		_wnum = wd + 1;
+	}
+	free(_wpaths[wd]);
+	_wpaths[wd] = strdup(path);
+
+	dir = opendir(path);
+	if (dir == NULL) {
+		return 0;
+	}
+
+	while ((de = readdir(dir)) != NULL) {
+		if ((de->d_name[0] == '.') ||
+			(snprintf(sub, MAXPATHLEN, "%s/%s", path, de->d_name) >=
+			 MAXPATHLEN)) {
+			continue;
+		}
+		if ((de->d_type == DT_DIR) || ((de->d_type == DT_LNK) && isDir(sub))) {
+			num += watchTree(sub, add);
+		}
+		else if (add && (de->d_type == DT_REG)) {
+			num += dbUpdatePath(sub);
+		}
+	}
+	closedir(dir);
+
+	return num;
+}
+
+/**
+ * follows a move of a watched directory
+ */
+static void watchRename(const char *from, const char *to) {
+	char path[MAXPATHLEN];
+	size_t len = strlen(from);
+
+	for (int32_t i = 0; i < _wnum; i++) {
+		if ((_wpaths[i] != NULL) && !strncmp(_wpaths[i], from, len) &&
+			((_wpaths[i][len] == 0) || (_wpaths[i][len] == '/'))) {
+			snprintf(path, MAXPATHLEN, "%s%s", to, _wpaths[i] + len);
+			free(_wpaths[i]);
+			_wpaths[i] = strdup(path);
+		}
+	}
+}
+
+/**
+ * stops watching path and the directories below. Needed when a directory
+ * is moved out of the musicdir
+ */
+static void watchForget(const char *path) {
+	size_t len = strlen(path);
+
+	for (int32_t i = 0; i < _wnum; i++) {
+		if ((_wpaths[i] != NULL) && !strncmp(_wpaths[i], path, len) &&
+			((_wpaths[i][len] == 0) || (_wpaths[i][len] == '/'))) {
+			inotify_rm_watch(_wfd, i);
+			free(_wpaths[i]);
+			_wpaths[i] = NULL;
+		}
+	}
+}
+
+/**
+ * appends a change to the pending changes
+ */
+static void watchQueue(watchop_t op, const char *path, uint32_t cookie) {
+	if (_wevnum == 0) {
+		clock_gettime(CLOCK_MONOTONIC, &_wfirst);
+	}
+	_wevents = (watchevent_t *) frealloc(_wevents, (_wevnum + 1) *
+										 sizeof (watchevent_t));
+	_wevents[_wevnum].op = op;
+	_wevents[_wevnum].path = strdup(path);
+	_wevents[_wevnum].to = NULL;
+	_wevents[_wevnum].cookie = cookie;
+	_wevnum++;
+}
+
+/**
+ * turns an inotify event into a pending change
+ */
+static void watchEvent(const struct inotify_event *ev) {
+	char path[MAXPATHLEN];
+	bool isdir = (ev->mask & IN_ISDIR);
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		if (_wevnum == 0) {
+			clock_gettime(CLOCK_MONOTONIC, &_wfirst);
+		}
+		_woverflow = true;
+		return;
+	}
+
+	if ((ev->wd < 0) || (ev->wd >= _wnum) || (_wpaths[ev->wd] == NULL)) {
+		return;
+	}
+
+	/* the directory is gone */
+	if (ev->mask & IN_IGNORED) {
+		free(_wpaths[ev->wd]);
+		_wpaths[ev->wd] = NULL;
+		return;
+	}
+
+	/* hidden files are not scanned either */
+	if ((ev->len == 0) || (ev->name[0] == '.') ||
+		(snprintf(path, MAXPATHLEN, "%s/%s", _wpaths[ev->wd], ev->name) >=
+		 MAXPATHLEN)) {
+		return;
+	}
+
+	/* new files are taken when they are closed */
+	if ((ev->mask & IN_CREATE) && isdir) {
+		watchTree(path, false);
+		watchQueue(watch_update, path, 0);
+	}
+	if (ev->mask & IN_CLOSE_WRITE) {
+		watchQueue(watch_update, path, 0);
+	}
+	if (ev->mask & IN_DELETE) {
+		watchQueue(watch_remove, path, 0);
+	}
+	if (ev->mask & IN_MOVED_FROM) {
+		watchQueue(watch_remove, path, ev->cookie);
+	}
+	if (ev->mask & IN_MOVED_TO) {
+		/* a move inside the musicdir keeps the titles */
+		for (uint32_t i = _wevnum; i > 0; i--) {
+			watchevent_t *from = &_wevents[i - 1];
+
+			if ((from->op == watch_remove) && (from->cookie != 0) &&
+				(from->cookie == ev->cookie)) {
+				from->op = watch_move;
+				from->to = strdup(path);
+				if (isdir) {
+					watchRename(from->path, path);
+				}
+				return;
+			}
+		}
+		if (isdir) {
+			watchTree(path, false);
+		}
+		watchQueue(watch_update, path, 0);
+	}
+}
+
+/**
+ * applies the pending changes to the database
+ */
+static void watchApply(const char *root) {
+	mpconfig_t *config = getConfig();
+	mptitle_t *ctitle = NULL;
+	int32_t changed = 0;
+	int32_t removed = 0;
+	int32_t added = 0;
+	int32_t dropped = 0;
+	int32_t num;
+
+	if (config->current != NULL) {
+		ctitle = config->current->title;
+	}
+
+	/* events got lost, so check everything */
+	if (_woverflow) {
+		addMessage(0, "Too many changes in %s, rescanning", root);
+		added = dbAddTitles(config->musicdir);
+		dropped = MAX(0, dbCheckExist());
+		_woverflow = false;
+	}
+
+	for (uint32_t i = 0; i < _wevnum; i++) {
+		watchevent_t *ev = &_wevents[i];
+
+		switch (ev->op) {
+		case watch_update:
+			if (isDir(ev->path)) {
+				changed += watchTree(ev->path, true);
+			}
+			else {
+				changed += dbUpdatePath(ev->path);
+			}
+			break;
+		case watch_move:
+			num = dbRenamePath(ev->path, ev->to);
+			/* the source was not known, so take it as new */
+			if (num == 0) {
+				num = isDir(ev->to) ? watchTree(ev->to, true) :
+					dbUpdatePath(ev->to);
+			}
+			changed += num;
+			break;
+		case watch_remove:
+			if (access(ev->path, F_OK) != 0) {
+				watchForget(ev->path);
+				removed += dbRemovePath(ev->path);
+			}
+			break;
+		}
+		free(ev->path);
+		free(ev->to);
+	}
+	free(_wevents);
+	_wevents = NULL;
+	_wevnum = 0;
+
+	if (changed + removed + added + dropped == 0) {
+		return;
+	}
+
+	lockCatalog();
+	addMessage(1, "%i titles changed, %i titles removed", changed + added,
+			   removed + dropped);
+	/* one write for the events and the rescan */
+	dbWrite(1);
+	setArtistSpread();
+	if ((removed + dropped > 0) && (ctitle != NULL) &&
+		(config->current != NULL)) {
+		checkAfterRemove(ctitle);
+	}
+	setTnum();
+	unlockCatalog();
+}
+
+/**
+ * drops the pending changes
+ */
+static void watchDrop(void) {
+	for (uint32_t i = 0; i < _wevnum; i++) {
+		free(_wevents[i].path);
+		free(_wevents[i].to);
+	}
+	free(_wevents);
+	_wevents = NULL;
+	_wevnum = 0;
+	_woverflow = false;
+}
+
+/**
+ * applies the pending changes as a background job. This runs on its own
+ * thread as throttleStart() cannot be undone on the watcher. The database
+ * functions lock the catalogue for each change, not while they read the
+ * files.
+ */
+static void *watchJob(void *root) {
+	throttleStart();
+	watchApply((const char *) root);
+	throttleEnd();
+	return NULL;
+}
+
+/**
+ * the watcher thread, collects changes until the musicdir is quiet and
+ * then applies them in one go.
+ */
+static void *_mpWatch( __attribute__ ((unused))
+					  void *arg) {
+	char buff[4096]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	char root[MAXPATHLEN];
+	struct pollfd pfd;
+	pthread_t tid;
+	ssize_t len;
+	int32_t rv;
+
+	/* wait for the database to be loaded */
+	while ((getConfig()->root == NULL) && (getConfig()->status != mpc_quit)) {
+		sleep(1);
+	}
+
+	strtcpy(root, getConfig()->musicdir, MAXPATHLEN - 1);
+	len = strlen(root);
+	while ((len > 1) && (root[len - 1] == '/')) {
+		root[--len] = 0;
+	}
+
+	_wfd = inotify_init1(IN_CLOEXEC);
+	if (_wfd == -1) {
+		addMessage(0, "Could not start watcher: %s", strerror(errno));
+		return NULL;
+	}
+
+	watchTree(root, false);
+	addMessage(1, "Watching %s", root);
+
+	pfd.fd = _wfd;
+	pfd.events = POLLIN;
+	while (getConfig()->status != mpc_quit) {
+		bool pending = (_wevnum > 0) || _woverflow;
+
+		rv = poll(&pfd, 1, pending ? WATCHDELAY : 1000);
+		if ((rv == -1) && (errno != EINTR)) {
+			addMessage(0, "Watcher failed: %s", strerror(errno));
+			break;
+		}
+
+		if (rv > 0) {
+			len = read(_wfd, buff, sizeof (buff));
+			for (char *pos = buff; pos < buff + len;) {
+				struct inotify_event *ev = (struct inotify_event *) pos;
+
+				watchEvent(ev);
+				pos += sizeof (struct inotify_event) + ev->len;
+			}
+		}
+
+		pending = (_wevnum > 0) || _woverflow;
+		if (pending && ((rv == 0) || (watchAge() > WATCHMAX))) {
+			/* stream mode or the database is being replaced */
+			if ((getConfig()->root == NULL) ||
+				!(getConfig()->mpmode & PM_DATABASE)) {
+				watchDrop();
+			}
+			/* events that come in meanwhile wait in the inotify queue */
+			else if (pthread_create(&tid, NULL, watchJob, root) == 0) {
+				pthread_setname_np(tid, "mpwatchjob");
+				pthread_join(tid, NULL);
+			}
+			else {
+				addMessage(0, "Could not create watcher job!");
+				watchApply(root);
+			}
+		}
+	}
+
+	watchDrop();
+	close(_wfd);
+	_wfd = -1;
+	return NULL;
+}
+
+pthread_t startWatcher(void) {
+	pthread_t tid;
+
+	if (pthread_create(&tid, NULL, _mpWatch, NULL) != 0) {
+		addMessage(0, "Could not create watcher thread!");
+		return -1;
+	}
+	pthread_setname_np(tid, "mpwatch");
+	pthread_detach(tid);
+	return tid;
+}
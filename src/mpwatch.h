@@ -0,0 +1,11 @@
+#ifndef __MPWATCH_H__
+#define __MPWATCH_H__ 1
+#include <pthread.h>
+
+/*
+ * follows changes in the musicdir with inotify and updates the database
+ * without rescans
+ */
+pthread_t startWatcher(void);
+
+#endif
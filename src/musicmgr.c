@@ -14,10 +14,14 @@
 #include <sys/sendfile.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <inttypes.h>
+#include <time.h>
 
 #include "database.h"
 #include "musicmgr.h"
 #include "mpgutils.h"
+#include "mpintern.h"
+#include "mpthrottle.h"
 #include "utils.h"
 
 /* Not a #define as we need the reference later */
@@ -74,6 +78,7 @@ static int32_t addToList(const char *line, mpcmd_t cmd) {
 mpplaylist_t *addPLDummy(mpplaylist_t * pl, const char *name) {
 	mpplaylist_t *buf;
 	mptitle_t *title = (mptitle_t *) falloc(1, sizeof (mptitle_t));
+	char text[MAXPATHLEN];
 
 	if (pl == NULL) {
 		pl = (mpplaylist_t *) falloc(1, sizeof (mpplaylist_t));
@@ -90,8 +95,14 @@ mpplaylist_t *addPLDummy(mpplaylist_t * pl, const char *name) {
 		}
 		pl = pl->prev;
 	}
-	strip(title->display, name, MAXPATHLEN - 1);
-	strip(title->title, name, NAMELEN - 1);
+	internText(title, &title->path, "");
+	title->artist = internTag("");
+	title->album = internTag("");
+	title->genre = internTag("");
+	strip(text, name, MAXPATHLEN - 1);
+	internText(title, &title->display, text);
+	strip(text, name, NAMELEN - 1);
+	internText(title, &title->title, text);
 
 	pl->title = title;
 
@@ -149,7 +160,8 @@ static mptitle_t *skipOverFlags(mptitle_t * current, uint32_t flags) {
 }
 
 static bool checkTitles(mptitle_t *titlea, mptitle_t *titleb) {
-	return (patMatch(titlea->artist, titleb->artist) || patMatch(titlea->title, titleb->title));
+	return (patMatchPrep(titlea->loartist, titleb->loartist) ||
+			patMatchPrep(titlea->lotitle, titleb->lotitle));
 }
 
 static void clearTDARK(mptitle_t * root) {
@@ -234,11 +246,11 @@ int32_t playCount(mptitle_t * title, int32_t skip) {
 				addMessage(1, "%s was skipped (%i/%i)!", title->display,
 						   title->skipcount, getConfig()->skipdnp);
 			}
-			dbMarkDirty();
+			dbUpdateCount(title);
 		}
 		else if (title->skipcount > 0) {
 			title->skipcount--;
-			dbMarkDirty();
+			dbUpdateCount(title);
 		}
 	}
 
@@ -253,7 +265,7 @@ int32_t playCount(mptitle_t * title, int32_t skip) {
 		if (!(title->flags & MP_FAV)) {
 			title->favpcount = title->playcount;
 		}
-		dbMarkDirty();
+		dbUpdateCount(title);
 	}
 
 	return rv;
@@ -352,22 +364,6 @@ mpplaylist_t *addToPL(mptitle_t * title, mpplaylist_t * target, bool mark) {
 	return target;
 }
 
-/**
- * helperfunction for scandir() - just return unhidden directories and links
- */
-static int32_t dsel(const struct dirent *entry) {
-	return ((entry->d_name[0] != '.') &&
-			((entry->d_type == DT_DIR) || (entry->d_type == DT_LNK)));
-}
-
-/**
- * helperfunction for scandir() - just return unhidden regular music files
- */
-static int32_t msel(const struct dirent *entry) {
-	return ((entry->d_name[0] != '.') &&
-			(entry->d_type == DT_REG) && isMusic(entry->d_name));
-}
-
 /**
  * helperfunction for scandir() - just return unhidden regular playlist files
  */
@@ -378,18 +374,17 @@ static int32_t plsel(const struct dirent *entry) {
 
 #define isnum(x) (((x)>'0') && ((x)<'9'))
 /**
- * helperfunction for scandir() sorts entries numerically first then
- * alphabetical
+ * compares two filenames numerically first then alphabetical
  */
-static int32_t tsort(const struct dirent **d1, const struct dirent **d2) {
+static int32_t tcmp(const char *n1, const char *n2) {
 	int32_t res = 0;
 
 	/* only do a numerical compare if both titles start with a number */
-	if (isnum((*d1)->d_name[0]) && isnum((*d2)->d_name[0])) {
-		res = atoi((*d1)->d_name) - atoi((*d2)->d_name);
+	if (isnum(n1[0]) && isnum(n2[0])) {
+		res = atoi(n1) - atoi(n2);
 	}
 	if (res == 0) {
-		res = strcasecmp((*d1)->d_name, (*d2)->d_name);
+		res = strcasecmp(n1, n2);
 	}
 	return res;
 }
@@ -397,24 +392,32 @@ static int32_t tsort(const struct dirent **d1, const struct dirent **d2) {
 #undef isnum
 
 /**
- * loads all playlists in cd into pllist
+ * helperfunction for scandir() sorts entries numerically first then
+ * alphabetical
  */
-int32_t getPlaylists(const char *cd, struct dirent ***pllist) {
-	return scandir(cd, pllist, plsel, tsort);
+static int32_t tsort(const struct dirent **d1, const struct dirent **d2) {
+	return tcmp((*d1)->d_name, (*d2)->d_name);
 }
 
 /**
- * loads all music files in cd into musiclist
+ * helperfunction for qsort() sorts filenames like tsort()
  */
-static int32_t getMusic(const char *cd, struct dirent ***musiclist) {
-	return scandir(cd, musiclist, msel, tsort);
+static int tnamesort(const void *n1, const void *n2) {
+	return tcmp(*(char *const *) n1, *(char *const *) n2);
 }
 
 /**
- * loads all directories in cd into dirlist
+ * helperfunction for qsort() sorts directory names like alphasort()
  */
-static int32_t getDirs(const char *cd, struct dirent ***dirlist) {
-	return scandir(cd, dirlist, dsel, alphasort);
+static int anamesort(const void *n1, const void *n2) {
+	return strcoll(*(char *const *) n1, *(char *const *) n2);
+}
+
+/**
+ * loads all playlists in cd into pllist
+ */
+int32_t getPlaylists(const char *cd, struct dirent ***pllist) {
+	return scandir(cd, pllist, plsel, tsort);
 }
 
 /**
@@ -434,59 +437,193 @@ static bool strieq(const char *t1, const char *t2) {
 	return true;
 }
 
-/*
- * checks if a title entry 'title' matches the search term 'pat'
- * the test is driven by the first two characters in the
- * search term. The first character gives the range (talgd(p))
- */
-static uint32_t matchTitle(mptitle_t * title, const char *pat) {
-	int32_t res = 0;
+/* the range characters of marklist entries, see addRangePrefix() */
+static const char MARKRANGES[] = "talgdp";
 
-	/* TODO: '=' vs '*' has been deprecated */
-	if (('=' == pat[1]) || ('*' == pat[1])) {
-		switch (pat[0]) {
-		case 't':
-			if (strieq(title->title, pat + 2))
-				res = mpc_title;
-			break;
+#define MARKSETS (sizeof (MARKRANGES) - 1)
 
-		case 'a':
-			if (strieq(title->artist, pat + 2))
-				res = mpc_artist;
-			break;
+/* an entry of a compiled marklist */
+typedef struct {
+	char *term;					/* the term or the prepared pattern */
+	uint32_t index;				/* position in the list, the first one wins */
+	bool equal;					/* '=' entry, these flag search results */
+} mpmark_t;
 
-		case 'l':
-			if (strieq(title->album, pat + 2))
-				res = mpc_album;
-			break;
+/* a marklist compiled into one case-folded set of terms per range */
+typedef struct {
+	mphash_t *terms[MARKSETS];	/* strihash(term) -> mpmark_t */
+	mpmark_t *loose;			/* prepared patterns without a range */
+	uint32_t lnum;
+	uint32_t num;				/* number of entries in the list */
+} mpmarks_t;
 
-		case 'g':
-			if (strieq(title->genre, pat + 2))
-				res = mpc_genre;
-			break;
+/* the compiled FAV and DNP lists, so search results can be flagged */
+static mpmarks_t *_favmarks = NULL;
+static mpmarks_t *_dnpmarks = NULL;
+static pthread_mutex_t _marklock = PTHREAD_MUTEX_INITIALIZER;
 
-		case 'd':
-			if (strieq(title->display, pat + 2))
-				res = mpc_display;
-			break;
+/**
+ * frees compiled marks, returns NULL for intuitive calling
+ */
+static mpmarks_t *marksWipe(mpmarks_t * marks) {
+	mphashentry_t *entry;
+
+	if (marks == NULL) {
+		return NULL;
+	}
 
-		case 'p':				/* still used in doublets */
-			if (strieq(title->path, pat + 2)) {
-				res = mpc_title;
+	for (uint32_t set = 0; set < MARKSETS; set++) {
+		for (uint32_t i = 0; i < marks->terms[set]->size; i++) {
+			for (entry = marks->terms[set]->bucket[i]; entry != NULL;
+				 entry = entry->next) {
+				free(((mpmark_t *) entry->data)->term);
+				free(entry->data);
 			}
-			break;
+		}
+		hashWipe(marks->terms[set]);
+	}
+	for (uint32_t i = 0; i < marks->lnum; i++) {
+		free(marks->loose[i].term);
+	}
+	free(marks->loose);
+	free(marks);
+	return NULL;
+}
 
-		default:
-			addMessage(0, "Unknown range %c in %s!", pat[0], pat);
-			break;
+/**
+ * adds a marklist line to the end of the compiled marks. The first
+ * character gives the range (talgd(p)), the term starts after the second.
+ */
+static void marksAdd(mpmarks_t * marks, const char *line) {
+	const char *range;
+	mpmark_t *mark;
+
+	/* TODO: '=' vs '*' has been deprecated */
+	if ((line[0] != 0) && (('=' == line[1]) || ('*' == line[1]))) {
+		range = strchr(MARKRANGES, line[0]);
+		if (range == NULL) {
+			addMessage(0, "Unknown range %c in %s!", line[0], line);
+			marks->num++;
+			return;
 		}
+		mark = (mpmark_t *) falloc(1, sizeof (mpmark_t));
+		mark->term = strdup(line + 2);
+		mark->equal = ('=' == line[1]);
+		hashAdd(marks->terms[range - MARKRANGES], strihash(line + 2), mark);
 	}
 	else {
-		addMessage(0, "Pattern without range: %s", pat);
-		if (patMatch(title->display, pat))
-			res = mpc_display;
+		addMessage(0, "Pattern without range: %s", line);
+		if ((marks->lnum & (marks->lnum - 1)) == 0) {
+			marks->loose = (mpmark_t *) frealloc(marks->loose,
+												 (marks->lnum ? marks->lnum *
+												  2 : 1) * sizeof (mpmark_t));
+		}
+		mark = &marks->loose[marks->lnum++];
+		mark->term = (char *) falloc(MAXPATHLEN + 1, 1);
+		patPrep(mark->term, line, MAXPATHLEN);
+		mark->equal = false;
+	}
+	mark->index = marks->num++;
+}
+
+/**
+ * compiles a marklist, so a title can be checked with one lookup per
+ * range instead of comparing it with every entry.
+ */
+static mpmarks_t *marksCompile(const marklist_t * list) {
+	mpmarks_t *marks = (mpmarks_t *) falloc(1, sizeof (mpmarks_t));
+	const marklist_t *ptr;
+	uint32_t num = 0;
+
+	for (ptr = list; ptr != NULL; ptr = ptr->next) {
+		num++;
+	}
+	for (uint32_t set = 0; set < MARKSETS; set++) {
+		marks->terms[set] = hashInit(num);
+	}
+	for (ptr = list; ptr != NULL; ptr = ptr->next) {
+		marksAdd(marks, ptr->dir);
+	}
+	return marks;
+}
+
+/**
+ * checks if the term is marked with '=' in the given range. The term is
+ * turned to lowercase like the lines that get added to the lists, but
+ * the case of the line must fit.
+ */
+static bool marksHas(const mpmarks_t * marks, char range, const char *term) {
+	uint32_t set = strchr(MARKRANGES, range) - MARKRANGES;
+	mphashentry_t *entry;
+	char loterm[MAXPATHLEN + 1] = "";
+
+	strltcat(loterm, term, MAXPATHLEN + 1);
+	for (entry = hashFirst(marks->terms[set], strihash(term)); entry != NULL;
+		 entry = hashNext(entry)) {
+		mpmark_t *mark = (mpmark_t *) entry->data;
+
+		if (mark->equal && (strcmp(mark->term, loterm) == 0)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * looks for an entry in the range that fits the term, ignoring the case.
+ * If it comes before the entry in first, first and res are set to it and
+ * the given result.
+ */
+static void marksFirst(const mpmarks_t * marks, char range, const char *term,
+					   uint32_t result, uint32_t * first, uint32_t * res) {
+	uint32_t set = strchr(MARKRANGES, range) - MARKRANGES;
+	mphashentry_t *entry;
+
+	for (entry = hashFirst(marks->terms[set], strihash(term)); entry != NULL;
+		 entry = hashNext(entry)) {
+		mpmark_t *mark = (mpmark_t *) entry->data;
+
+		if ((mark->index < *first) && strieq(mark->term, term)) {
+			*first = mark->index;
+			*res = result;
+		}
 	}
+}
 
+/*
+ * checks if a title entry 'title' matches the compiled marks in a range
+ * above 'above'. Like checking the entries of the list in order, the
+ * range of the first fitting entry is returned, or 0.
+ */
+static uint32_t matchTitle(const mptitle_t * title, const mpmarks_t * marks,
+						   uint32_t above) {
+	uint32_t first = UINT32_MAX;
+	uint32_t res = 0;
+
+	if (mpc_display > above) {
+		marksFirst(marks, 'd', title->display, mpc_display, &first, &res);
+		for (uint32_t i = 0; i < marks->lnum; i++) {
+			if ((marks->loose[i].index < first) &&
+				patMatchPrep(title->lodisplay, marks->loose[i].term)) {
+				first = marks->loose[i].index;
+				res = mpc_display;
+			}
+		}
+	}
+	/* 'p' is still used in doublets */
+	if (mpc_title > above) {
+		marksFirst(marks, 't', title->title, mpc_title, &first, &res);
+		marksFirst(marks, 'p', title->path, mpc_title, &first, &res);
+	}
+	if (mpc_album > above) {
+		marksFirst(marks, 'l', title->album, mpc_album, &first, &res);
+	}
+	if (mpc_artist > above) {
+		marksFirst(marks, 'a', title->artist, mpc_artist, &first, &res);
+	}
+	if (mpc_genre > above) {
+		marksFirst(marks, 'g', title->genre, mpc_genre, &first, &res);
+	}
 	return res;
 }
 
@@ -518,7 +655,7 @@ static int32_t addRangePrefix(mpcmd_t cmd, char *line) {
 }
 
 static void setFlags(searchentry_t * entry, mpcmd_t type) {
-	char line[MAXPATHLEN + 2];
+	char line[3];
 
 	if (isStreamActive()) {
 		/* never allow adding these */
@@ -531,26 +668,46 @@ static void setFlags(searchentry_t * entry, mpcmd_t type) {
 	entry->fav = false;
 
 	if (addRangePrefix(type, line) == 0) {
-		strltcat(line, entry->name, MAXPATHLEN + 2);
-		marklist_t *buff;
-
-		buff = getConfig()->favlist;
-		while (buff != NULL) {
-			if (strcmp(line, buff->dir) == 0) {
-				entry->fav = true;
-				break;
-			}
-			buff = buff->next;
+		pthread_mutex_lock(&_marklock);
+		if (_favmarks != NULL) {
+			entry->fav = marksHas(_favmarks, line[0], entry->name);
 		}
-
-		buff = getConfig()->dnplist;
-		while (buff != NULL) {
-			if (strcmp(line, buff->dir) == 0) {
-				entry->dnp = true;
-				break;
-			}
-			buff = buff->next;
+		if (_dnpmarks != NULL) {
+			entry->dnp = marksHas(_dnpmarks, line[0], entry->name);
 		}
+		pthread_mutex_unlock(&_marklock);
+	}
+}
+
+/**
+ * makes room for one more entry in a list of num search entries. The
+ * lists grow in powers of two.
+ */
+static searchentry_t *growEntries(searchentry_t * list, uint32_t num) {
+	if ((num & (num - 1)) == 0) {
+		list = (searchentry_t *) frealloc(list, (num ? num * 2 : 1) *
+										  sizeof (searchentry_t));
+	}
+	return list;
+}
+
+/**
+ * turns the album at index i into a sampler if the title's artist does
+ * not fit the album artist
+ */
+static void checkSampler(searchresults_t * res, uint32_t i,
+						 const mptitle_t * title) {
+	if ((res->albart[i].id == title->artistid) ||
+		strieq(res->albart[i].name, ARTIST_SAMPLER)) {
+		return;
+	}
+
+	/* fuzzy comparation to avoid collabs turning an album into a sampler */
+	if (!patMatch(res->albart[i].name, title->artist)) {
+		addMessage(1, "%s is considered a sampler (%s <> %s).",
+				   title->album, title->artist, res->albart[i].name);
+		res->albart[i].name = ARTIST_SAMPLER;
+		res->albart[i].id = 0;
 	}
 }
 
@@ -564,49 +721,520 @@ static void setFlags(searchentry_t * entry, mpcmd_t type) {
  * the last added titles.
  */
 static void addAlbum(searchresults_t * res, mptitle_t * title) {
-	uint32_t i = 0;
+	mphashentry_t *entry = hashFirst(res->albidx, title->albumid);
+	uint32_t i = res->lnum;
 
-	/* In the unlikely case that we found more than MAXSEARCH albums, just ignore */
-	if (res->lnum > MAXSEARCH)
-		return;
-
-	while ((i < res->lnum)
-		   && !strieq(res->albums[i].name, title->album))
-		i++;
-	if (i == res->lnum) {
-		/* album not yet in list */
+	if (entry == NULL) {
+		/* album not yet in list, remember its index + 1 */
+		res->albums = growEntries(res->albums, res->lnum);
+		res->albart = growEntries(res->albart, res->lnum);
 		res->lnum++;
-		res->albums =
-			(searchentry_t *) frealloc(res->albums,
-									   res->lnum * sizeof (searchentry_t));
 		res->albums[i].name = title->album;
+		res->albums[i].id = title->albumid;
 		setFlags(&res->albums[i], mpc_album);
-		res->albart =
-			(searchentry_t *) frealloc(res->albart,
-									   res->lnum * sizeof (searchentry_t));
 		res->albart[i].name = title->artist;
+		res->albart[i].id = title->artistid;
+		hashAdd(res->albidx, title->albumid, (void *) (uintptr_t) (i + 1));
 	}
-	/* fuzzy comparation to avoid collabs turning an album into a sampler */
-	else if (!strieq(res->albart[i].name, ARTIST_SAMPLER) &&
-			 !patMatch(res->albart[i].name, title->artist)) {
-		addMessage(1, "%s is considered a sampler (%s <> %s).",
-				   title->album, title->artist, res->albart[i].name);
-		res->albart[i].name = ARTIST_SAMPLER;
+	/* albums of earlier pages have no index */
+	else if (entry->data != NULL) {
+		checkSampler(res, (uintptr_t) entry->data - 1, title);
+	}
+}
+
+/**
+ * checks a title against the prepared pattern and returns the ranges
+ * the title will be added to the results for.
+ * This only reads the title, so it is safe to be called in parallel.
+ */
+static int32_t searchMatch(const mptitle_t * runner, const mpcmd_t range,
+						   const char *lopat) {
+	int32_t found = 0;
+
+	/* check for searchrange and patterns */
+	if (MPC_ISTITLE(range) && patMatchPrep(runner->lotitle, lopat)) {
+		found |= mpc_title;
+	}
+
+	/* from a result point of view display(, path) and title are the same */
+	if (MPC_ISDISPLAY(range)
+		&& patMatchPrep(runner->lodisplay, lopat)) {
+		found |= mpc_title;
+	}
+
+	if (MPC_ISARTIST(range)
+		&& patMatchPrep(runner->loartist, lopat)) {
+		found |= mpc_artist;
+
+		/* Add albums and titles if search was for artists only */
+		if (MPC_EQARTIST(range)) {
+			found |= mpc_title | mpc_album;
+		}
 	}
+
+	if (MPC_ISALBUM(range) && patMatchPrep(runner->loalbum, lopat)) {
+		found |= mpc_album;
+
+		/* Add titles if search was for albums only */
+		if (MPC_EQALBUM(range)) {
+			found |= mpc_title;
+		}
+	}
+
+	return found;
+}
+
+/* titles that a search worker takes at once */
+#define SEARCHCHUNK 1024
+
+/* shared state of a parallel search */
+typedef struct {
+	mptitle_t **titles;			/* the titles to check in database order */
+	int32_t *found;				/* the result of searchMatch() per title */
+	uint32_t num;
+	uint32_t next;				/* first title of the next chunk */
+	mpcmd_t range;
+	const char *lopat;
+	pthread_mutex_t lock;
+} mpsearch_t;
+
+/**
+ * worker thread that checks chunks of titles until all are done
+ */
+static void *searchWorker(void *arg) {
+	mpsearch_t *search = (mpsearch_t *) arg;
+	uint32_t start;
+	uint32_t end;
+
+	while (1) {
+		pthread_mutex_lock(&search->lock);
+		start = search->next;
+		search->next = MIN(search->num, start + SEARCHCHUNK);
+		pthread_mutex_unlock(&search->lock);
+		if (start >= search->num) {
+			break;
+		}
+
+		end = MIN(search->num, start + SEARCHCHUNK);
+		for (uint32_t i = start; i < end; i++) {
+			search->found[i] =
+				searchMatch(search->titles[i], search->range, search->lopat);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * checks num titles and returns what searchMatch() found for each of
+ * them. Big lists are split into chunks that are checked in parallel.
+ * The returned list must be free'd by the caller.
+ */
+static int32_t *searchTitles(mptitle_t ** titles, uint32_t num,
+							 const mpcmd_t range, const char *lopat) {
+	uint32_t workers = getConfig()->searchworkers;
+	uint32_t started = 0;
+	mpsearch_t search;
+	pthread_t *tid;
+
+	memset(&search, 0, sizeof (search));
+	search.titles = titles;
+	search.found = (int32_t *) falloc(num + 1, sizeof (int32_t));
+	search.num = num;
+	search.range = range;
+	search.lopat = lopat;
+
+	if (workers == 0) {
+		workers = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	workers = MIN(workers, num / SEARCHCHUNK);
+
+	if (workers < 2) {
+		for (uint32_t i = 0; i < num; i++) {
+			search.found[i] = searchMatch(titles[i], range, lopat);
+		}
+		return search.found;
+	}
+
+	pthread_mutex_init(&search.lock, NULL);
+
+	/* the calling thread does its share too */
+	tid = (pthread_t *) falloc(workers - 1, sizeof (pthread_t));
+	for (uint32_t i = 0; i < workers - 1; i++) {
+		if (pthread_create(&tid[started], NULL, searchWorker, &search) == 0) {
+			pthread_setname_np(tid[started], "searcher");
+			started++;
+		}
+	}
+	searchWorker(&search);
+
+	for (uint32_t i = 0; i < started; i++) {
+		pthread_join(tid[i], NULL);
+	}
+	free(tid);
+	pthread_mutex_destroy(&search.lock);
+
+	return search.found;
+}
+
+/* number of recent searches to remember */
+#define SEARCHCACHE 8
+
+/* the matches of a recent search */
+typedef struct {
+	char *lopat;				/* the prepared pattern, NULL if unused */
+	mpcmd_t range;
+	uint32_t gen;				/* database generation of the matches */
+	mptitle_t **titles;			/* the matching titles in database order */
+	int32_t *found;				/* what searchMatch() found for them */
+	uint32_t *score;			/* how well they fit, see searchScore() */
+	uint32_t num;
+	uint32_t used;				/* to replace the oldest entry */
+} mpsearchcache_t;
+
+static mpsearchcache_t _searchcache[SEARCHCACHE];
+static uint32_t _searchuse = 0;
+/* all clients share the cache, it is locked to look up and store a
+ * search and to take a page from it, but not while titles are checked */
+static pthread_mutex_t _searchlock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * returns the number of characters of a pattern with len characters that
+ * patMatch() allows to miss
+ */
+static size_t searchSlack(size_t len) {
+	return len - (len * SIMGUARD + 99) / 100;
+}
+
+/**
+ * checks if every title that matches lopat also matched the earlier
+ * pattern oldpat in the same field. Then the earlier matches are enough
+ * to search for lopat, apart from titles with keys shorter than lopat as
+ * these keys become the pattern. This is the case when lopat just adds
+ * characters to oldpat and patMatch() does not get more tolerant on the
+ * way.
+ */
+static bool searchRefines(const char *oldpat, const char *lopat) {
+	size_t oldlen = strlen(oldpat);
+	size_t len = strlen(lopat);
+
+	/* short patterns are literal substrings the other way round */
+	if ((oldlen < 3) || (oldlen >= len) || strncmp(oldpat, lopat, oldlen)) {
+		return false;
+	}
+	/* both need an exact match */
+	if (len <= MATCHLEVEL) {
+		return true;
+	}
+	/* shifts and misses must be allowed for both to the same amount */
+	return (oldlen > MATCHLEVEL) && (searchSlack(oldlen) == searchSlack(len));
+}
+
+/**
+ * returns the cached search for the prepared pattern or the longest
+ * cached search it refines. Returns NULL if there is none.
+ * must be called with _searchlock held!
+ */
+static mpsearchcache_t *searchCached(const mpcmd_t range, const char *lopat,
+									 uint32_t gen) {
+	mpsearchcache_t *base = NULL;
+
+	for (uint32_t i = 0; i < SEARCHCACHE; i++) {
+		mpsearchcache_t *entry = &_searchcache[i];
+
+		if ((entry->lopat == NULL) || (entry->range != range) ||
+			(entry->gen != gen)) {
+			continue;
+		}
+		if (strcmp(entry->lopat, lopat) == 0) {
+			entry->used = ++_searchuse;
+			return entry;
+		}
+		if (searchRefines(entry->lopat, lopat) &&
+			((base == NULL) || (strlen(entry->lopat) > strlen(base->lopat)))) {
+			base = entry;
+		}
+	}
+
+	return base;
+}
+
+/**
+ * returns how well a key fits the pattern. Among keys that fit equally
+ * well the ones that are not much longer than the pattern win.
+ */
+static uint32_t searchKeyScore(const char *lokey, const char *lopat) {
+	size_t klen = strlen(lokey);
+	size_t plen = strlen(lopat);
+
+	return patScore(lokey, lopat) * 128 +
+		(100 * MIN(klen, plen)) / MAX(MAX(klen, plen), 1);
+}
+
+/**
+ * ranks a matching title by its best fitting key in the search range
+ */
+static uint32_t searchScore(const mptitle_t * title, const mpcmd_t range,
+							const char *lopat) {
+	uint32_t score = 0;
+
+	if (MPC_ISTITLE(range)) {
+		score = MAX(score, searchKeyScore(title->lotitle, lopat));
+	}
+	if (MPC_ISDISPLAY(range)) {
+		score = MAX(score, searchKeyScore(title->lodisplay, lopat));
+	}
+	if (MPC_ISARTIST(range)) {
+		score = MAX(score, searchKeyScore(title->loartist, lopat));
+	}
+	if (MPC_ISALBUM(range)) {
+		score = MAX(score, searchKeyScore(title->loalbum, lopat));
+	}
+
+	return score;
+}
+
+/**
+ * remembers the matches among the num checked titles in place of the
+ * oldest search. Takes over the titles and found lists.
+ * must be called with _searchlock held!
+ */
+static mpsearchcache_t *searchStore(const mpcmd_t range, const char *lopat,
+									uint32_t gen, mptitle_t ** titles,
+									int32_t * found, uint32_t num) {
+	mpsearchcache_t *entry = &_searchcache[0];
+	uint32_t cnt = 0;
+
+	for (uint32_t i = 1; i < SEARCHCACHE; i++) {
+		if (_searchcache[i].used < entry->used) {
+			entry = &_searchcache[i];
+		}
+	}
+	free(entry->lopat);
+	free(entry->titles);
+	free(entry->found);
+	free(entry->score);
+
+	for (uint32_t i = 0; i < num; i++) {
+		if (found[i] != 0) {
+			titles[cnt] = titles[i];
+			found[cnt] = found[i];
+			cnt++;
+		}
+	}
+	titles[cnt] = NULL;
+
+	entry->lopat = strdup(lopat);
+	entry->range = range;
+	entry->gen = gen;
+	entry->titles =
+		(mptitle_t **) frealloc(titles, (cnt + 1) * sizeof (mptitle_t *));
+	entry->found = (int32_t *) frealloc(found, (cnt + 1) * sizeof (int32_t));
+	entry->score = (uint32_t *) falloc(cnt + 1, sizeof (uint32_t));
+	for (uint32_t i = 0; i < cnt; i++) {
+		if (MPC_ISTITLE(found[i])) {
+			entry->score[i] = searchScore(titles[i], range, lopat);
+		}
+	}
+	entry->num = cnt;
+	entry->used = ++_searchuse;
+
+	return entry;
+}
+
+/**
+ * returns true if match a ranks before match b. Better scores come
+ * first, equal ones stay in database order.
+ */
+static bool searchBefore(const mpsearchcache_t * cached, uint32_t a,
+						 uint32_t b) {
+	return (cached->score[a] > cached->score[b]) ||
+		((cached->score[a] == cached->score[b]) && (a < b));
+}
+
+/**
+ * moves the match at pos down in the heap of num matches until both
+ * children rank before it. So the worst match is on top.
+ */
+static void searchSift(const mpsearchcache_t * cached, uint32_t * heap,
+					   uint32_t num, uint32_t pos) {
+	uint32_t child;
+	uint32_t swap;
+
+	while ((child = 2 * pos + 1) < num) {
+		/* the worse child */
+		if ((child + 1 < num) &&
+			searchBefore(cached, heap[child], heap[child + 1])) {
+			child++;
+		}
+		if (!searchBefore(cached, heap[pos], heap[child])) {
+			break;
+		}
+		swap = heap[pos];
+		heap[pos] = heap[child];
+		heap[child] = swap;
+		pos = child;
+	}
+}
+
+/**
+ * adds the matching titles with the ranks pos to pos + MAXSEARCH to the
+ * results. Only the best matches up to the end of the page are kept in
+ * a heap, the rest is never sorted.
+ * Returns the rank to start the next page with.
+ */
+static uint32_t searchPageTitles(searchresults_t * res,
+								 const mpsearchcache_t * cached, uint32_t pos) {
+	uint32_t want = pos + MAXSEARCH;
+	uint32_t *heap = (uint32_t *) falloc(want, sizeof (uint32_t));
+	mpplaylist_t *last = NULL;
+	uint32_t total = 0;
+	uint32_t num = 0;
+	uint32_t swap;
+
+	for (uint32_t i = 0; i < cached->num; i++) {
+		if (!MPC_ISTITLE(cached->found[i])) {
+			continue;
+		}
+		total++;
+		if (num < want) {
+			heap[num++] = i;
+			if (num == want) {
+				for (uint32_t j = want / 2; j-- > 0;) {
+					searchSift(cached, heap, num, j);
+				}
+			}
+		}
+		else if (searchBefore(cached, i, heap[0])) {
+			heap[0] = i;
+			searchSift(cached, heap, num, 0);
+		}
+	}
+
+	if (num < want) {
+		for (uint32_t j = num / 2; j-- > 0;) {
+			searchSift(cached, heap, num, j);
+		}
+	}
+	/* take the worst one off the top until the best is left */
+	for (uint32_t j = num; j-- > 1;) {
+		swap = heap[0];
+		heap[0] = heap[j];
+		heap[j] = swap;
+		searchSift(cached, heap, j, 0);
+	}
+
+	for (uint32_t j = pos; j < num; j++) {
+		last = addToPL(cached->titles[heap[j]], last, false);
+		if (res->titles == NULL) {
+			res->titles = last;
+		}
+		res->tnum++;
+	}
+	free(heap);
+
+	return (total > want) ? want : cached->num;
+}
+
+/**
+ * adds up to MAXSEARCH new artists starting at match pos to the results.
+ * The artists of the matches before pos have been on earlier pages.
+ * Returns the match to start the next page with.
+ */
+static uint32_t searchPageArtists(searchresults_t * res,
+								  const mpsearchcache_t * cached,
+								  uint32_t pos) {
+	mptitle_t *title;
+	uint32_t i;
+
+	for (i = 0; i < cached->num; i++) {
+		if (!MPC_ISARTIST(cached->found[i])) {
+			continue;
+		}
+		title = cached->titles[i];
+		if (hashFirst(res->artidx, title->artistid) != NULL) {
+			continue;
+		}
+		if (i < pos) {
+			hashAdd(res->artidx, title->artistid, NULL);
+			continue;
+		}
+		if (res->anum == MAXSEARCH) {
+			break;
+		}
+		res->artists = growEntries(res->artists, res->anum);
+		res->artists[res->anum].name = title->artist;
+		res->artists[res->anum].id = title->artistid;
+		setFlags(&res->artists[res->anum], mpc_artist);
+		hashAdd(res->artidx, title->artistid, NULL);
+		res->anum++;
+	}
+
+	return i;
+}
+
+/**
+ * adds up to MAXSEARCH new albums starting at match pos to the results.
+ * The albums of the matches before pos have been on earlier pages. All
+ * later matches are still checked for samplers.
+ * Returns the match to start the next page with.
+ */
+static uint32_t searchPageAlbums(searchresults_t * res,
+								 const mpsearchcache_t * cached, uint32_t pos) {
+	uint32_t next = cached->num;
+	mptitle_t *title;
+
+	for (uint32_t i = 0; i < cached->num; i++) {
+		if (!MPC_ISALBUM(cached->found[i])) {
+			continue;
+		}
+		title = cached->titles[i];
+		if (i < pos) {
+			if (hashFirst(res->albidx, title->albumid) == NULL) {
+				hashAdd(res->albidx, title->albumid, NULL);
+			}
+			continue;
+		}
+		if ((res->lnum == MAXSEARCH) &&
+			(hashFirst(res->albidx, title->albumid) == NULL)) {
+			next = MIN(next, i);
+			continue;
+		}
+		addAlbum(res, title);
+	}
+
+	return next;
 }
 
 /**
  * fills the global searchresult structure with the results of the given search.
- * Returns the number of found titles.
+ * Returns the number of found titles or -1 if there are more pages.
  * pat - pattern to search for
  * range - search range
+ * cursor - the cursor of the last page to get the next one, or NULL. A
+ *          cursor of another search or an older database starts over
+ *          with the first page and sets restart.
  */
-int32_t search(const mpcmd_t range, const char *pat, int32_t cid) {
+int32_t search(const mpcmd_t range, const char *pat, const char *cursor,
+			   int32_t cid) {
 	mpconfig_t *control = getConfig();
-	mptitle_t *root = control->root;
-	mptitle_t *runner = root;
+	mptitle_t *root;
+	mptitle_t *runner;
 	searchresults_t *res = control->found;
+	char lopat[MAXPATHLEN + 1];
+	mptitle_t **candidates;
+	mptitle_t **within = NULL;
+	mpsearchcache_t *cached;
+	int32_t *found;
+	uint32_t num = 0;
+	uint32_t gen;
+	uint32_t key;
+	uint32_t cgen = 0;
+	uint32_t ckey = 0;
 	uint32_t i = 0;
+	uint32_t tpos = 0;
+	uint32_t apos = 0;
+	uint32_t lpos = 0;
 
 	/* lock result to the proper client */
 	res->cid=cid;
@@ -616,21 +1244,34 @@ int32_t search(const mpcmd_t range, const char *pat, int32_t cid) {
 	res->tnum = 0;
 	res->anum = 0;
 	res->lnum = 0;
+	res->cursor[0] = 0;
+	res->restart = false;
+	res->artidx = hashWipe(res->artidx);
+	res->artidx = hashInit(MAXSEARCH);
+	res->albidx = hashWipe(res->albidx);
+	res->albidx = hashInit(MAXSEARCH);
+
+	/* jobs only lock the titles for short changes, so this does not wait
+	 * for a cleanup */
+	dbLockTitles();
+	root = control->root;
+	runner = root;
 
 	if (root == NULL) {
+		dbUnlockTitles();
 		addAlert(0, "No database loaded.");
 		return 0;
 	}
 
 	if (MPC_ISRECENT(range)) {
-		char *lastal = NULL;
+		uint32_t lastal = 0;
 		/* return at last MPPLSIZE titles and last MPPLSIZE albums 
 		   TODO: This will add the first title of each album as a new title. Questionable! */
 		do {
 			runner = runner->prev;
 			/* two titles in a row with the same album? */
-			if (strieq(runner->album, runner->prev->album)) {
-				lastal = runner->album;
+			if (runner->albumid == runner->prev->albumid) {
+				lastal = runner->albumid;
 				if (res->lnum < MPPLSIZE) {
 					addAlbum(res, runner);
 					if (res->lnum >= MPPLSIZE) {
@@ -644,7 +1285,7 @@ int32_t search(const mpcmd_t range, const char *pat, int32_t cid) {
 
 			/* skip last album title or add single title */
 			if (res->tnum < MPPLSIZE) {
-				if ((lastal == NULL) || !strieq(runner->album, lastal)) {
+				if (runner->albumid != lastal) {
 					res->titles = appendToPL(runner, res->titles, false);
 					res->tnum++;
 				}
@@ -652,76 +1293,88 @@ int32_t search(const mpcmd_t range, const char *pat, int32_t cid) {
 		} while ((runner->prev != root) && ((res->tnum < MPPLSIZE) || (res->tnum < MPPLSIZE)));
 	}
 	else {
-		/* actual search */
-		do {
-			int found = 0;
-
-			/* check for searchrange and patterns */
-			if (MPC_ISTITLE(range) && patMatch(runner->title, pat)) {
-				found |= mpc_title;
-			}
-
-			/* from a result point of view display(, path) and title are the same */
-			if (MPC_ISDISPLAY(range)
-				&& patMatch(runner->display, pat)) {
-				found |= mpc_title;
-			}
-
-			if (MPC_ISARTIST(range)
-				&& patMatch(runner->artist, pat)) {
-				found |= mpc_artist;
-
-				/* Add albums and titles if search was for artists only */
-				if (MPC_EQARTIST(range)) {
-					found |= mpc_title | mpc_album;
+		/* the titles carry their prepared keys, so only the pattern is left */
+		patPrep(lopat, pat, MAXPATHLEN);
+
+		/* type-ahead repeats and extends the last patterns. The cache is
+		 * only locked to look up and store searches, another search may
+		 * replace the entry meanwhile, so refine a copy of its titles */
+		pthread_mutex_lock(&_searchlock);
+		gen = dbGeneration();
+		cached = searchCached(range, lopat, gen);
+		if ((cached != NULL) && strcmp(cached->lopat, lopat)) {
+			within = (mptitle_t **) falloc(cached->num + 1,
+										   sizeof (mptitle_t *));
+			memcpy(within, cached->titles,
+				   cached->num * sizeof (mptitle_t *));
+			cached = NULL;
+		}
+		if (cached == NULL) {
+			pthread_mutex_unlock(&_searchlock);
+
+			/* let the index pick the titles that may match */
+			candidates = dbFindTitles(lopat, within);
+			free(within);
+			if (candidates == NULL) {
+				do {
+					num++;
+					runner = runner->next;
+				} while (runner != root);
+
+				candidates =
+					(mptitle_t **) falloc(num + 1, sizeof (mptitle_t *));
+				for (i = 0; i < num; i++) {
+					candidates[i] = runner;
+					runner = runner->next;
 				}
 			}
-
-			if (MPC_ISALBUM(range) && patMatch(runner->album, pat)) {
-				found |= mpc_album;
-
-				/* Add titles if search was for albums only */
-				if (MPC_EQALBUM(range)) {
-					found |= mpc_title;
+			else {
+				while (candidates[num] != NULL) {
+					num++;
 				}
 			}
+			found = searchTitles(candidates, num, range, lopat);
 
-			/* now interpret the value of 'found' */
-
-			if (MPC_ISARTIST(found) && (res->anum <= MAXSEARCH)) {
-				/* check for new artist */
-				for (i = 0; (i < res->anum)
-					 && !strieq(res->artists[i].name, runner->artist); i++);
-				if (i == res->anum) {
-					res->anum++;
-					res->artists =
-						(searchentry_t *) frealloc(res->artists,
-												   res->anum *
-												   sizeof (searchentry_t));
-					res->artists[i].name = runner->artist;
-					setFlags(&res->artists[i], mpc_artist);
-				}
-			}
+			pthread_mutex_lock(&_searchlock);
+			cached = searchStore(range, lopat, gen, candidates, found, num);
+		}
 
-			if (MPC_ISALBUM(found)) {
-				/* check for new albums */
-				addAlbum(res, runner);
+		/* the cursor holds the generation and the search it belongs to,
+		 * the next title rank and the next artist and album match */
+		key = strhash(lopat) ^ (uint32_t) range;
+		if (cursor != NULL) {
+			if (sscanf(cursor, "%" SCNx32 "-%" SCNx32 "-%" SCNx32
+					   "-%" SCNx32 "-%" SCNx32, &cgen, &ckey,
+					   &tpos, &apos, &lpos) != 5) {
+				addMessage(0, "Invalid search cursor %s", cursor);
+				cgen = gen + 1;
 			}
-
-			if (MPC_ISTITLE(found) && (res->tnum <= MAXSEARCH)) {
-				res->titles = appendToPL(runner, res->titles, false);
-				res->tnum++;
+			/* the ranks of another search or database are useless */
+			if ((cgen != gen) || (ckey != key)) {
+				addAlert(cid, "Search results changed, starting over!");
+				res->restart = true;
+				tpos = apos = lpos = 0;
 			}
-
-			runner = runner->next;
-		} while (runner != root);
+		}
+		tpos = MIN(tpos, cached->num);
+		tpos = searchPageTitles(res, cached, tpos);
+		apos = searchPageArtists(res, cached, apos);
+		lpos = searchPageAlbums(res, cached, lpos);
+		if ((tpos < cached->num) || (apos < cached->num) ||
+			(lpos < cached->num)) {
+			snprintf(res->cursor, CURSORLEN,
+					 "%" PRIx32 "-%" PRIx32 "-%" PRIx32 "-%" PRIx32 "-%"
+					 PRIx32, gen, key, tpos, apos, lpos);
+		}
+		pthread_mutex_unlock(&_searchlock);
 	}
+	dbUnlockTitles();
 
 	uint32_t maxret = res->tnum;
 	if (res->anum > maxret) maxret = res->anum;
 	if (res->lnum > maxret) maxret = res->lnum;
 
-	return ((maxret > MAXSEARCH) ? -1 : (int32_t) maxret);
+	return ((res->cursor[0] != 0) ? -1 : (int32_t) maxret);
 }
 
 /**
@@ -749,20 +1402,19 @@ static void cleanPLByFlag(uint32_t flag) {
 }
 
 /**
- * applies the dnplist on a list of titles and marks matching titles
+ * applies the compiled DNP marks on the titles and marks matching titles
  * if the title is part of the playlist it will be removed from the playlist
  * too. This may lead to double played artists though...
  *
- * returns the number of marked titles or -1 on error
+ * returns the number of marked titles
  */
-int32_t applyDNPlist(marklist_t * list) {
+static int32_t applyDNPmarks(const mpmarks_t * marks) {
 	mptitle_t *base = getConfig()->root;
 	mptitle_t *pos = base;
-	marklist_t *ptr = list;
 	int32_t cnt = 0;
 	uint32_t range = 0;
 
-	if (NULL == list) {
+	if (NULL == base) {
 		return 0;
 	}
 
@@ -770,17 +1422,11 @@ int32_t applyDNPlist(marklist_t * list) {
 
 	do {
 		if (!(pos->flags & (MP_DBL | MP_DNP))) {
-			ptr = list;
-
-			while (ptr) {
-				range = matchTitle(pos, ptr->dir);
-				if (range > MPC_RANGE(pos->flags)) {
-					addMessage(4, "[D] %s: %s", ptr->dir, pos->display);
-					pos->flags = (range | MP_DNP);
-					cnt++;
-					break;
-				}
-				ptr = ptr->next;
+			range = matchTitle(pos, marks, MPC_RANGE(pos->flags));
+			if (range > MPC_RANGE(pos->flags)) {
+				addMessage(4, "[D] %s", pos->display);
+				pos->flags = (range | MP_DNP);
+				cnt++;
 			}
 		}
 		pos = pos->next;
@@ -794,6 +1440,26 @@ int32_t applyDNPlist(marklist_t * list) {
 	return cnt;
 }
 
+/**
+ * applies the dnplist on a list of titles, see applyDNPmarks()
+ *
+ * returns the number of marked titles or -1 on error
+ */
+int32_t applyDNPlist(marklist_t * list) {
+	mpmarks_t *marks;
+	int32_t cnt;
+
+	if (NULL == list) {
+		return 0;
+	}
+
+	marks = marksCompile(list);
+	cnt = applyDNPmarks(marks);
+	marksWipe(marks);
+
+	return cnt;
+}
+
 /**
  * applies the dbllist on a list of titles and marks matching titles
  * if the title is part of the playlist it will be removed from the playlist
@@ -802,9 +1468,8 @@ int32_t applyDNPlist(marklist_t * list) {
  * returns the number of marked titles or -1 on error
  */
 int32_t applyDBLlist(marklist_t * list) {
-	mptitle_t *base = getConfig()->root;
-	mptitle_t *pos = base;
 	marklist_t *ptr = list;
+	mptitle_t *pos;
 	int32_t cnt = 0;
 
 	if (NULL == list) {
@@ -812,23 +1477,22 @@ int32_t applyDBLlist(marklist_t * list) {
 	}
 
 	activity(0, "Applying DBL list");
-	do {
-		if (!(pos->flags & MP_DBL)) {
-			ptr = list;
+	while (ptr) {
+		/* doublets are always full paths */
+		if (startsWith(ptr->dir, "p=")) {
+			pos = getTitleByPath(ptr->dir + 2);
+		}
+		else {
+			pos = getTitleByPath(ptr->dir);
+		}
 
-			while (ptr) {
-				if (strcmp(ptr->dir, pos->path) == 0) {
-					addMessage(4, "[DB] %s: %s", ptr->dir, pos->display);
-					pos->flags = (MPC_DFRANGE | MP_DBL);
-					cnt++;
-					break;
-				}
-				ptr = ptr->next;
-			}
+		if ((pos != NULL) && !(pos->flags & MP_DBL)) {
+			addMessage(4, "[DB] %s: %s", ptr->dir, pos->display);
+			pos->flags = (MPC_DFRANGE | MP_DBL);
+			cnt++;
 		}
-		pos = pos->next;
+		ptr = ptr->next;
 	}
-	while (pos != base);
 
 	cleanPLByFlag(MP_DBL);
 
@@ -838,10 +1502,9 @@ int32_t applyDBLlist(marklist_t * list) {
 }
 
 /**
- * This function sets the favourite bit on titles found in the given list
+ * This function sets the favourite bit on titles found in the compiled marks
  */
-static int32_t applyFAVlist(marklist_t * favourites) {
-	marklist_t *ptr = NULL;
+static int32_t applyFAVmarks(const mpmarks_t * marks) {
 	mptitle_t *root = getConfig()->root;
 	mptitle_t *runner = root;
 	int32_t cnt = 0;
@@ -852,31 +1515,16 @@ static int32_t applyFAVlist(marklist_t * favourites) {
 		return -1;
 	}
 
-	if (favourites == NULL) {
-		return 0;
-	}
-
 	activity(0, "Applying FAV list");
 
 	do {
-		if (!(runner->flags & MP_DBL)) {
-			ptr = favourites;
-
-			while (ptr) {
-				range = matchTitle(runner, ptr->dir);
-				if (range > MPC_RANGE(runner->flags)) {
-					if (!(runner->flags & MP_FAV)) {
-						addMessage(4, "[F] %s: %s", ptr->dir, runner->display);
-						/* Save MP_INPL */
-						runner->flags =
-							(runner->flags & MP_INPL) | MP_FAV | range;
-						cnt++;
-					}
-					ptr = NULL;
-				}
-				else {
-					ptr = ptr->next;
-				}
+		if (!(runner->flags & (MP_DBL | MP_FAV))) {
+			range = matchTitle(runner, marks, MPC_RANGE(runner->flags));
+			if (range > MPC_RANGE(runner->flags)) {
+				addMessage(4, "[F] %s", runner->display);
+				/* Save MP_INPL */
+				runner->flags = (runner->flags & MP_INPL) | MP_FAV | range;
+				cnt++;
 			}
 		}
 		runner = runner->next;
@@ -887,6 +1535,24 @@ static int32_t applyFAVlist(marklist_t * favourites) {
 	return cnt;
 }
 
+/**
+ * This function sets the favourite bit on titles found in the given list
+ */
+static int32_t applyFAVlist(marklist_t * favourites) {
+	mpmarks_t *marks;
+	int32_t cnt;
+
+	if (favourites == NULL) {
+		return 0;
+	}
+
+	marks = marksCompile(favourites);
+	cnt = applyFAVmarks(marks);
+	marksWipe(marks);
+
+	return cnt;
+}
+
 /* reset the given flags on all titles */
 static void unsetFlags(uint32_t flags) {
 	mptitle_t *guard = getConfig()->root;
@@ -905,8 +1571,19 @@ void applyLists(int32_t clean) {
 	if (clean) {
 		unsetFlags(MPC_DFRANGE | MP_FAV | MP_DNP);
 	}
-	applyFAVlist(control->favlist);
-	applyDNPlist(control->dnplist);
+	/* compile the lists once, search results are flagged with them too */
+	pthread_mutex_lock(&_marklock);
+	_favmarks = marksWipe(_favmarks);
+	_favmarks = marksCompile(control->favlist);
+	_dnpmarks = marksWipe(_dnpmarks);
+	_dnpmarks = marksCompile(control->dnplist);
+	if (control->favlist != NULL) {
+		applyFAVmarks(_favmarks);
+	}
+	if (control->dnplist != NULL) {
+		applyDNPmarks(_dnpmarks);
+	}
+	pthread_mutex_unlock(&_marklock);
 	unlockPlaylist();
 	setTnum();
 	notifyChange(MPCOMM_LISTS);
@@ -1304,32 +1981,36 @@ mptitle_t *loadPlaylist(const char *path) {
 }
 
 mptitle_t *addNewPath(const char *path) {
-	mptitle_t *tail = getConfig()->root;
-	mptitle_t *newt = (mptitle_t *) falloc(1, sizeof (mptitle_t));
+	mptitle_t *title;
+	mptitle_t *newt;
+	struct stat st;
+
+	/* the tags are read before the title goes live */
+	newt = (mptitle_t *) falloc(1, sizeof (mptitle_t));
+	internText(newt, &newt->path, path);
+	if (stat(path, &st) == 0) {
+		newt->size = st.st_size;
+		newt->mtime = st.st_mtime;
+		newt->inode = st.st_ino;
+	}
+	fillTagInfo(newt);
+	internTitle(newt);
 
-	do {
-		if (strcmp(path, tail->path) == 0) {
-			/* should only happen during development */
-			addMessage(0, "Title already exists in database. Weird!");
-			free(newt);
-			return tail;
-		}
-		tail = tail->next;
+	lockCatalog();
+	title = getTitleByPath(path);
+	if (title != NULL) {
+		/* another job added it meanwhile */
+		addMessage(1, "%s is already in the database", path);
+		unlockCatalog();
+		freeTitle(newt);
+		return title;
 	}
-	while (tail != getConfig()->root);
 
-	newt->key = tail->key + 1;
+	/* append after the last title so the new key is unique */
 	newt->playcount = getPlaycount(count_mean);
-	strtcpy(newt->path, path, MAXPATHLEN);
-
-	newt->next = tail->next;
-	newt->prev = tail;
-	tail->next = newt;
-	newt->next->prev = newt;
-
-	fillTagInfo(newt);
-
+	dbAppendTitle(newt);
 	dbMarkDirty();
+	unlockCatalog();
 	return newt;
 }
 
@@ -1339,17 +2020,7 @@ mptitle_t *addNewPath(const char *path) {
  * access()
  **/
 bool mp3FileExists(const char *name) {
-	mptitle_t *runner = getConfig()->root;
-
-	do {
-		if (endsWith(runner->path, name)) {
-			return true;
-		}
-		runner = runner->next;
-	}
-	while (runner != getConfig()->root);
-
-	return false;
+	return (getTitleByName(name) != NULL);
 }
 
 /**
@@ -1373,8 +2044,9 @@ mptitle_t *insertTitle(mptitle_t * base, const char *path) {
 		root->next->prev = root;
 	}
 
-	strtcpy(root->path, path, MAXPATHLEN);
+	internText(root, &root->path, path);
 	fillTagInfo(root);
+	internTitle(root);
 
 	return root;
 }
@@ -1839,7 +2511,7 @@ void plCheck(bool fill) {
 			pl->next = NULL;
 			while (buf != NULL) {
 				pl = buf->next;
-				free(buf->title);
+				freeTitle(buf->title);
 				free(buf);
 				buf = pl;
 			}
@@ -1940,16 +2612,174 @@ void plCheck(bool fill) {
 	notifyChange(MPCOMM_TITLES);
 }
 
-/*
- * Steps recursively through a directory and collects all music files in a list
- * curdir: current directory path
- * files:  the list to store filenames in
- * returns the LAST entry of the list.
+/* a music file found by the scan */
+typedef struct {
+	char *path;
+	uint64_t size;
+	int64_t mtime;
+	uint64_t inode;
+} mpscanfile_t;
+
+/* shared state of a parallel scan */
+typedef struct {
+	mpscanfile_t *files;		/* the files to scan in the final order */
+	mptitle_t *titles;			/* one preallocated title per path */
+	uint32_t num;
+	uint32_t size;				/* room in files */
+	char **dirs;				/* directories still to be read */
+	uint32_t dnum;
+	uint32_t dsize;				/* room in dirs */
+	uint32_t next;				/* next path to be taken by a worker */
+	uint32_t done;				/* number of scanned titles */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} mpscan_t;
+
+/* buffer for the directory entries of one getdents64() call */
+#define SCANBUFF 32768
+
+/**
+ * appends a music file to the scan unless it did not change since the
+ * last scan. The file is stat'ed relative to its directory and the scan
+ * must have room for it.
  */
-mptitle_t *recurse(char *curdir, mptitle_t * files) {
-	char dirbuff[2 * MAXPATHLEN];
-	struct dirent **entry = NULL;
-	int32_t num, i;
+static void scanFile(mpscan_t * scan, int32_t dfd, const char *dir,
+					 const char *name) {
+	char path[MAXPATHLEN];
+	struct stat st;
+
+	if (snprintf(path, MAXPATHLEN, "%s/%s", dir, name) >= MAXPATHLEN) {
+		addMessage(0, "Path too long for %s", name);
+		return;
+	}
+	if (fstatat(dfd, name, &st, 0) == -1) {
+		addMessage(1, "Could not stat %s", path);
+		return;
+	}
+	/* the tags of unchanged files are already known */
+	if (dbFileUnchanged(path, st.st_size, st.st_mtime, st.st_ino)) {
+		return;
+	}
+
+	scan->files[scan->num].path = strdup(path);
+	scan->files[scan->num].size = st.st_size;
+	scan->files[scan->num].mtime = st.st_mtime;
+	scan->files[scan->num].inode = st.st_ino;
+	scan->num++;
+}
+
+/**
+ * makes room for num entries of esize bytes in list, size holds the
+ * current room and grows in powers of two. Returns the list.
+ */
+static void *scanGrow(void *list, uint32_t * size, uint32_t num,
+					  size_t esize) {
+	if (num <= *size) {
+		return list;
+	}
+	if (*size == 0) {
+		*size = 16;
+	}
+	while (*size < num) {
+		*size *= 2;
+	}
+	return frealloc(list, *size * esize);
+}
+
+/**
+ * reads one directory in a single pass. The music files are added to the
+ * scan in tsort() order and the subdirectories are pushed on the directory
+ * stack so that they get popped in alphabetical order.
+ */
+static void scanOne(mpscan_t * scan, const char *dir, char *buff) {
+	char **files = NULL;
+	char **subs = NULL;
+	uint32_t fnum = 0;
+	uint32_t fsize = 0;
+	uint32_t dnum = 0;
+	uint32_t dsize = 0;
+	struct stat st;
+	ssize_t len;
+	int32_t dfd;
+
+	addMessage(3, "Checking %s", dir);
+
+	dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd == -1) {
+		addMessage(0, "Could not read %s: %s", dir, strerror(errno));
+		return;
+	}
+
+	while ((len = getdents64(dfd, buff, SCANBUFF)) > 0) {
+		for (ssize_t pos = 0; pos < len;) {
+			struct dirent64 *de = (struct dirent64 *) (buff + pos);
+			uint8_t type = de->d_type;
+
+			pos += de->d_reclen;
+			if (de->d_name[0] == '.') {
+				continue;
+			}
+			/* only stat what the filesystem did not tell */
+			if ((type == DT_UNKNOWN) || (type == DT_LNK)) {
+				if (fstatat(dfd, de->d_name, &st, 0) == -1) {
+					continue;
+				}
+				if (S_ISDIR(st.st_mode)) {
+					type = DT_DIR;
+				}
+				/* links to files were never followed */
+				else if (S_ISREG(st.st_mode) && (type == DT_UNKNOWN)) {
+					type = DT_REG;
+				}
+			}
+
+			if (type == DT_DIR) {
+				subs = (char **) scanGrow(subs, &dsize, dnum + 1,
+										  sizeof (char *));
+				subs[dnum++] = strdup(de->d_name);
+			}
+			else if ((type == DT_REG) && isMusic(de->d_name)) {
+				files = (char **) scanGrow(files, &fsize, fnum + 1,
+										   sizeof (char *));
+				files[fnum++] = strdup(de->d_name);
+			}
+		}
+	}
+	if (len == -1) {
+		addMessage(0, "Could not read %s: %s", dir, strerror(errno));
+	}
+
+	qsort(files, fnum, sizeof (char *), tnamesort);
+	scan->files = (mpscanfile_t *) scanGrow(scan->files, &scan->size,
+											scan->num + fnum,
+											sizeof (mpscanfile_t));
+	for (uint32_t i = 0; i < fnum; i++) {
+		scanFile(scan, dfd, dir, files[i]);
+		free(files[i]);
+	}
+	free(files);
+	close(dfd);
+
+	/* reverse order, so the first directory is on top */
+	qsort(subs, dnum, sizeof (char *), anamesort);
+	scan->dirs = (char **) scanGrow(scan->dirs, &scan->dsize,
+									scan->dnum + dnum, sizeof (char *));
+	for (uint32_t i = dnum; i > 0; i--) {
+		char *path = (char *) falloc(strlen(dir) + strlen(subs[i - 1]) + 2, 1);
+
+		sprintf(path, "%s/%s", dir, subs[i - 1]);
+		scan->dirs[scan->dnum++] = path;
+		free(subs[i - 1]);
+	}
+	free(subs);
+}
+
+/**
+ * collects the music files in curdir and all subdirectories. The
+ * directories are walked depth first with an explicit stack.
+ */
+static void scanDir(char *curdir, mpscan_t * scan) {
+	char *buff = (char *) falloc(SCANBUFF, 1);
 
 	/* this means the config is broken */
 	assert(curdir != NULL);
@@ -1958,40 +2788,147 @@ mptitle_t *recurse(char *curdir, mptitle_t * files) {
 		curdir[strlen(curdir) - 1] = 0;
 	}
 
-	addMessage(3, "Checking %s", curdir);
+	scan->dirs = (char **) scanGrow(scan->dirs, &scan->dsize, 1,
+									sizeof (char *));
+	scan->dirs[scan->dnum++] = strdup(curdir);
+	while (scan->dnum > 0) {
+		char *dir = scan->dirs[--scan->dnum];
+
+		scanOne(scan, dir, buff);
+		free(dir);
+	}
+
+	free(scan->dirs);
+	scan->dirs = NULL;
+	scan->dsize = 0;
+	free(buff);
+}
+
+/**
+ * worker thread that reads the tags of the collected files
+ */
+static void *scanWorker(void *arg) {
+	mpscan_t *scan = (mpscan_t *) arg;
+	uint32_t i;
+
+	while (1) {
+		pthread_mutex_lock(&scan->lock);
+		i = scan->next++;
+		pthread_mutex_unlock(&scan->lock);
+		if (i >= scan->num) {
+			break;
+		}
 
-	/* get all music files */
-	num = getMusic(curdir, &entry);
+		internText(&scan->titles[i], &scan->titles[i].path,
+				   scan->files[i].path);
+		scan->titles[i].size = scan->files[i].size;
+		scan->titles[i].mtime = scan->files[i].mtime;
+		scan->titles[i].inode = scan->files[i].inode;
+		throttle(1, fillTagInfo(&scan->titles[i]));
+		internTitle(&scan->titles[i]);
 
-	if (num < 0) {
-		addMessage(0, "getMusic failed in %s", curdir);
+		pthread_mutex_lock(&scan->lock);
+		scan->done++;
+		if (scan->done == scan->num) {
+			pthread_cond_signal(&scan->cond);
+		}
+		pthread_mutex_unlock(&scan->lock);
+	}
+
+	return NULL;
+}
+
+/**
+ * scans curdir and all subdirectories for music and appends the titles
+ * to files. The directories are read first, then the tags are read in
+ * parallel and the titles are linked in directory order. Files that did
+ * not change since the last scan are skipped.
+ * returns the last title in the list.
+ */
+mptitle_t *recurse(char *curdir, mptitle_t * files) {
+	mpscan_t scan;
+	pthread_t *tid;
+	uint32_t workers = getConfig()->scanworkers;
+	uint32_t started = 0;
+	struct timespec start;
+	struct timespec now;
+	struct timespec timeout;
+
+	memset(&scan, 0, sizeof (scan));
+	activity(0, "Scanning");
+	scanDir(curdir, &scan);
+	if (scan.num == 0) {
+		free(scan.files);
 		return files;
 	}
 
-	for (i = 0; i < num; i++) {
-		activity(0, "Scanning");
-		sprintf(dirbuff, "%s/%s", curdir, entry[i]->d_name);
-		files = insertTitle(files, dirbuff);
-		free(entry[i]);
+	if (workers == 0) {
+		workers = sysconf(_SC_NPROCESSORS_ONLN);
 	}
+	workers = MAX(1, MIN(workers, scan.num));
 
-	free(entry);
+	addMessage(1, "Reading %" PRIu32 " files with %" PRIu32 " workers",
+			   scan.num, workers);
 
-	/* step down subdirectories */
-	num = getDirs(curdir, &entry);
+	scan.titles = allocTitles(scan.num);
+	pthread_mutex_init(&scan.lock, NULL);
+	pthread_cond_init(&scan.cond, NULL);
 
-	if (num < 0) {
-		addMessage(0, "getDirs failed on %s", curdir);
-		return files;
+	tid = (pthread_t *) falloc(workers, sizeof (pthread_t));
+	for (uint32_t i = 0; i < workers; i++) {
+		if (pthread_create(&tid[started], NULL, scanWorker, &scan) == 0) {
+			pthread_setname_np(tid[started], "tagreader");
+			started++;
+		}
+	}
+	if (started == 0) {
+		scanWorker(&scan);
+	}
+
+	/* report progress while the workers read */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_mutex_lock(&scan.lock);
+	while (scan.done < scan.num) {
+		uint64_t ms;
+
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_sec++;
+		pthread_cond_timedwait(&scan.cond, &scan.lock, &timeout);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (now.tv_sec - start.tv_sec) * 1000 +
+			(now.tv_nsec - start.tv_nsec) / 1000000;
+		activity(0, "Scanning %" PRIu32 "/%" PRIu32 " (%" PRIu64 " files/s)",
+				 scan.done, scan.num,
+				 (ms > 0) ? (1000 * (uint64_t) scan.done) / ms : 0);
 	}
+	pthread_mutex_unlock(&scan.lock);
 
-	for (i = 0; i < num; i++) {
-		sprintf(dirbuff, "%s/%s", curdir, entry[i]->d_name);
-		files = recurse(dirbuff, files);
-		free(entry[i]);
+	for (uint32_t i = 0; i < started; i++) {
+		pthread_join(tid[i], NULL);
 	}
+	free(tid);
+	pthread_mutex_destroy(&scan.lock);
+	pthread_cond_destroy(&scan.cond);
 
-	free(entry);				// false coverity positive, getDirs allocates a new 'entry'
+	/* link the titles in the order they were found */
+	for (uint32_t i = 0; i < scan.num; i++) {
+		mptitle_t *title = &scan.titles[i];
+
+		if (files == NULL) {
+			title->next = title;
+			title->prev = title;
+		}
+		else {
+			title->next = files->next;
+			title->prev = files;
+			files->next = title;
+			title->next->prev = title;
+		}
+		files = title;
+		free(scan.files[i].path);
+	}
+	free(scan.files);
 
 	return files;
 }
@@ -2234,6 +3171,7 @@ static int32_t rangeToLine(mpcmd_t cmd, const mptitle_t * title,
 int32_t handleRangeCmd(mpcmd_t cmd, mptitle_t * title) {
 	char line[MAXPATHLEN + 2];
 	marklist_t *buff, *list;
+	mpmarks_t **marks;
 	int32_t cnt = -1;
 	mpconfig_t *config = getConfig();
 
@@ -2285,6 +3223,15 @@ int32_t handleRangeCmd(mpcmd_t cmd, mptitle_t * title) {
 		/* add line to the file */
 		addToList(buff->dir, cmd);
 
+		/* and to the compiled list */
+		pthread_mutex_lock(&_marklock);
+		marks = (MPC_CMD(cmd) == mpc_fav) ? &_favmarks : &_dnpmarks;
+		if (*marks == NULL) {
+			*marks = marksCompile(NULL);
+		}
+		marksAdd(*marks, buff->dir);
+		pthread_mutex_unlock(&_marklock);
+
 		/* apply actual line to the playlist */
 		if (MPC_CMD(cmd) == mpc_fav) {
 			cnt = applyFAVlist(buff);
@@ -5,11 +5,14 @@
 
 /* for MAXPATHLEN */
 #include "utils.h"
+#include "mphash.h"
 /* Directory access */
 
 #define NAMELEN 64
-/* do not return more than 50 titles */
+/* do not return more than 50 titles, artists and albums on a page */
 #define MAXSEARCH 50
+/* length of a search cursor, five hex numbers */
+#define CURSORLEN 48
 
 /* length of past and future titles, so a playlist has 2*MPPLSIZE+1 titles */
 #define MPPLSIZE 10
@@ -33,20 +36,38 @@
 #define MP_DEF   (getFavplay()? MP_FAV : MP_ALL)
 
 typedef struct mptitle_s mptitle_t;
+typedef struct mpowned_s mpowned_t;	/* strings kept by a title */
+/* the fields used by the mixer come first so that they share one cache
+ * line, the strings are only needed once a title has been picked */
 struct mptitle_s {
-	char path[MAXPATHLEN];		/* path on the filesystem to the file */
-	char artist[NAMELEN];		/* Artist info */
-	char title[NAMELEN];		/* Title info (from mp3) */
-	char album[NAMELEN];		/* Album info (from mp3) */
+	mptitle_t *prev;			/* database pointers */
+	mptitle_t *next;
+	uint32_t key;				/* DB key/index  - internal */
+	uint32_t flags;				/* FAV/DNP       - internal */
 	uint32_t playcount;			/* play counter */
 	uint32_t favpcount;			/* transient favplaycount */
 	uint32_t skipcount;			/* skip counter */
-	char genre[NAMELEN];
-	uint32_t key;				/* DB key/index  - internal */
-	char display[MAXPATHLEN];	/* Title display - internal */
-	uint32_t flags;				/* FAV/DNP       - internal */
-	mptitle_t *prev;			/* database pointers */
-	mptitle_t *next;
+	uint32_t artistid;			/* interned artist - internal */
+	uint32_t albumid;			/* interned album  - internal */
+	uint32_t genreid;			/* interned genre  - internal */
+	/* the strings are set with internText() and internTags(), the tags
+	 * are shared, the rest belongs to the title and lives as long as
+	 * the title does */
+	const char *path;			/* path on the filesystem to the file */
+	const char *artist;			/* Artist info */
+	const char *title;			/* Title info (from mp3) */
+	const char *album;			/* Album info (from mp3) */
+	const char *genre;
+	const char *display;		/* Title display - internal */
+	/* search keys for patMatchPrep(), set by internTitle() */
+	const char *loartist;		/* shared with all titles of the artist */
+	const char *loalbum;
+	const char *lotitle;
+	const char *lodisplay;
+	mpowned_t *owned;			/* replaced strings - internal */
+	uint64_t size;				/* file size for rescans */
+	int64_t mtime;				/* file modification time for rescans */
+	uint64_t inode;				/* file inode to follow moved files */
 };
 
 /* A list of titles that keeps the title chain intact */
@@ -64,7 +85,8 @@ typedef enum {
 } mpcount_t;
 
 typedef struct {
-	char *name;
+	const char *name;			/* tag of a title, never free'd */
+	uint32_t id;				/* interned name, server only */
 	bool fav;
 	bool dnp;
 } searchentry_t;
@@ -77,6 +99,10 @@ typedef struct {
 	searchentry_t *artists;
 	searchentry_t *albums;
 	searchentry_t *albart;
+	char cursor[CURSORLEN];		/* to get the next page, empty on the last */
+	bool restart;				/* a stale cursor sent the first page */
+	mphash_t *artidx;			/* reported artists, server only */
+	mphash_t *albidx;			/* reported albums, server only */
 	int32_t cid;
 } searchresults_t;
 
@@ -101,7 +127,8 @@ mptitle_t *recurse(char *curdir, mptitle_t * files);
 mptitle_t *rewindTitles(mptitle_t * base);
 mptitle_t *loadPlaylist(const char *path);
 mptitle_t *insertTitle(mptitle_t * base, const char *path);
-int32_t search(const mpcmd_t range, const char *pat, int32_t cid);
+int32_t search(const mpcmd_t range, const char *pat, const char *cursor,
+			   int32_t cid);
 mptitle_t *addNewPath(const char *path);
 bool mp3FileExists(const char *name);
 
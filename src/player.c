@@ -14,6 +14,7 @@
 #include "mpalsa.h"
 #include "database.h"
 #include "controller.h"
+#include "mpintern.h"
 
 #define MPV 10
 #define WATCHDOG_TIMEOUT 15
@@ -184,21 +185,29 @@ void *setProfile(void *arg) {
 	}
 
 	/* only load database if it has not yet been used */
+	lockCatalog();
 	if (control->root == NULL) {
-		control->root = dbGetMusic();
+		dbSetRoot(dbGetMusic());
+	}
+	unlockCatalog();
+
+	/* the scan locks the catalogue on its own */
+	if (NULL == control->root) {
+		addMessage(0, "Scanning musicdir");
+		num = dbAddTitles(control->musicdir);
+		if (0 == num) {
+			fail(F_FAIL, "No music found at %s!", control->musicdir);
+		}
+		addMessage(0, "Added %i titles.", num);
+		lockCatalog();
+		/* load the titles in one block from the new database */
+		dbWrite(1);
+		dbSetRoot(dbGetMusic());
+		unlockCatalog();
 		if (NULL == control->root) {
-			addMessage(0, "Scanning musicdir");
-			num = dbAddTitles(control->musicdir);
-			if (0 == num) {
-				fail(F_FAIL, "No music found at %s!", control->musicdir);
-			}
-			addMessage(0, "Added %i titles.", num);
-			control->root = dbGetMusic();
-			if (NULL == control->root) {
-				fail(F_FAIL,
-					 "No music found at %s for database %s!\nThis should never happen!",
-					 control->musicdir, control->dbname);
-			}
+			fail(F_FAIL,
+				 "No music found at %s for database %s!\nThis should never happen!",
+				 control->musicdir, control->dbname);
 		}
 	}
 
@@ -573,14 +582,17 @@ void *reader( __attribute__ ((unused))
 
 					/* Stream name */
 					if (NULL != strstr(line, "ICY-NAME: ")) {
+						char text[NAMELEN];
+
 						/* if prev is NULL it would mean the stream started before
 						 * it was set - shouldn't ever happen */
 						if (control->current->prev == NULL) {
 							fail(F_FAIL, "Stream started on it's own!");
 						}
 
-						strip(control->current->prev->title->title,
-							  line + 13, NAMELEN - 1);
+						strip(text, line + 13, NAMELEN - 1);
+						internText(control->current->prev->title,
+								   &control->current->prev->title->title, text);
 						notifyChange(MPCOMM_TITLES);
 					}
 
@@ -588,6 +600,7 @@ void *reader( __attribute__ ((unused))
 					if (NULL != strstr(line, "ICY-META")) {
 						/* StreamTitle='artist - title' -> apos[,tpos] */
 						char *apos = strstr(line, "StreamTitle='");
+						char text[MAXPATHLEN];
 
 						if (apos != NULL) {
 							addMessage(MPV + 3, "%s", apos);
@@ -627,8 +640,10 @@ void *reader( __attribute__ ((unused))
 									(!patMatch
 									 (control->current->title->artist,
 									  control->current->title->album) == 0)) {
-									strip(control->current->title->display,
-										  apos, MAXPATHLEN - 1);
+									strip(text, apos, MAXPATHLEN - 1);
+									internText(control->current->title,
+											   &control->current->title->display,
+											   text);
 								}
 								else {
 									/* create a new title */
@@ -643,23 +658,32 @@ void *reader( __attribute__ ((unused))
 								tpos = strstr(apos, " - ");
 								if (tpos != NULL) {
 									*tpos = 0;
-									strip(control->current->title->artist,
-										  apos, NAMELEN - 1);
-									strip(control->current->title->title,
-										  tpos + 3, NAMELEN - 1);
+									strip(text, apos, NAMELEN - 1);
+									internOwn(control->current->title,
+											  &control->current->title->artist,
+											  text);
+									strip(text, tpos + 3, NAMELEN - 1);
+									internText(control->current->title,
+											   &control->current->title->title,
+											   text);
 								}
 
 								/* can't find a title, so everything goes into the title
 								 * line (this is centered and large on the display) */
 								else {
-									strip(control->current->title->title, apos,
-										  NAMELEN - 1);
+									strip(text, apos, NAMELEN - 1);
+									internText(control->current->title,
+											   &control->current->title->title,
+											   text);
 								}
 
 								plCheck(false);
-								/* carry over stream title as album entry */
-								strcpy(control->current->title->album,
-									   control->current->prev->title->title);
+								/* carry over stream title as album entry, stream
+								 * titles keep their own strings and stay out of
+								 * the pools */
+								internOwn(control->current->title,
+										  &control->current->title->album,
+										  control->current->prev->title->title);
 
 								/* filter out 'things' */
 								if (strcasecmp
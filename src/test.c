@@ -11,6 +11,8 @@
 #include <errno.h>
 
 #include "musicmgr.h"
+#include "database.h"
+#include "mpintern.h"
 
 /*
  * Print errormessage and exit
@@ -34,12 +36,279 @@ void fail(const int32_t error, const char *msg, ...) {
 	exit(0);
 }
 
+/*
+ * fills text with up to len random characters that are likely to show up
+ * in titles, including divisors, whitespace and UTF-8
+ */
+static void randomText(char *text, size_t len) {
+	const char chars[] = "aabcdeeilnorstu AEX-./&()  \xc3\xb6";
+	size_t num = random() % (len + 1);
+
+	for (size_t i = 0; i < num; i++) {
+		text[i] = chars[random() % (sizeof (chars) - 1)];
+	}
+	text[num] = 0;
+}
+
+/*
+ * changes a few random characters so the text stays similar
+ */
+static void mutateText(char *text, size_t len) {
+	size_t tlen = strlen(text);
+	uint32_t num = random() % 4;
+
+	for (uint32_t i = 0; (i < num) && (tlen > 0); i++) {
+		size_t pos = random() % tlen;
+
+		switch (random() % 3) {
+		case 0:				/* replace */
+			text[pos] = 'a' + random() % 26;
+			break;
+		case 1:				/* delete */
+			memmove(text + pos, text + pos + 1, tlen - pos);
+			tlen--;
+			break;
+		default:				/* insert */
+			if (tlen + 1 < len) {
+				memmove(text + pos + 1, text + pos, tlen - pos + 1);
+				text[pos] = 'a' + random() % 26;
+				tlen++;
+			}
+		}
+	}
+}
+
+/*
+ * reference for patScore(), the edit distance of the shorter text to any
+ * part of the longer one by the plain dynamic programming table
+ */
+static uint32_t patScoreRef(const char *lotext1, const char *lotext2) {
+	const char *lopat = lotext1;
+	const char *lotext = lotext2;
+	uint32_t col[MAXPATHLEN + 1];
+	uint32_t best;
+	size_t plen;
+	size_t tlen;
+
+	if (strlen(lotext1) >= strlen(lotext2)) {
+		lopat = lotext2;
+		lotext = lotext1;
+	}
+	plen = strlen(lopat);
+	tlen = strlen(lotext);
+
+	if (plen < 3) {
+		return (strstr(lopat, lotext) != NULL) ? 100 : 0;
+	}
+
+	for (size_t i = 0; i <= plen; i++) {
+		col[i] = i;
+	}
+	best = plen;
+	for (size_t j = 0; j < tlen; j++) {
+		uint32_t diag = 0;
+
+		/* the match may start anywhere */
+		col[0] = 0;
+		for (size_t i = 1; i <= plen; i++) {
+			uint32_t up = col[i];
+
+			col[i] = MIN(MIN(col[i] + 1, col[i - 1] + 1),
+						 diag + (lopat[i - 1] != lotext[j]));
+			diag = up;
+		}
+		best = MIN(best, col[plen]);
+	}
+
+	return (100 * (plen - best)) / plen;
+}
+
+/*
+ * checks all similarity kernels of patMatch() against the scalar one
+ * and patScore() against the reference
+ * returns the number of differences
+ */
+static int32_t patKernelTest(uint32_t rounds) {
+	char text1[MAXPATHLEN + 1];
+	char text2[MAXPATHLEN + 1];
+	char lotext1[MAXPATHLEN + 1];
+	char lotext2[MAXPATHLEN + 1];
+	uint32_t similar = 0;
+	int32_t errors = 0;
+	bool res;
+
+	srandom(rounds);
+	for (uint32_t i = 0; i < rounds; i++) {
+		/* mostly short texts and a pattern taken from the text */
+		randomText(text1, (i % 10) ? 40 : MAXPATHLEN - 1);
+		if (i % 3) {
+			size_t len = strlen(text1);
+			size_t pos = len ? random() % len : 0;
+
+			strtcpy(text2, text1 + pos, (random() % (len - pos + 1)) + 1);
+			mutateText(text2, MAXPATHLEN);
+		}
+		else {
+			randomText(text2, (i % 10) ? 40 : MAXPATHLEN - 1);
+		}
+
+		patPrep(lotext1, text1, MAXPATHLEN);
+		patPrep(lotext2, text2, MAXPATHLEN);
+		res = patMatchKernel(lotext1, lotext2, pat_scalar);
+		if (res) {
+			similar++;
+		}
+
+		if (patMatch(text1, text2) != res) {
+			printf("patMatch: '%s' '%s'\n", text1, text2);
+			errors++;
+		}
+		for (patkernel_t k = pat_auto; k <= pat_avx2; k++) {
+			if (patKernelAvailable(k) &&
+				(patMatchKernel(lotext1, lotext2, k) != res)) {
+				printf("Kernel %i: '%s' '%s'\n", k, lotext1, lotext2);
+				errors++;
+			}
+		}
+		if ((MIN(strlen(lotext1), strlen(lotext2)) <= 64) &&
+			(patScore(lotext1, lotext2) != patScoreRef(lotext1, lotext2))) {
+			printf("patScore: '%s' '%s'\n", lotext1, lotext2);
+			errors++;
+		}
+	}
+
+	for (patkernel_t k = pat_sse2; k <= pat_avx2; k++) {
+		printf("Kernel %i is %savailable\n", k,
+			   patKernelAvailable(k) ? "" : "not ");
+	}
+	printf("%u pairs, %u similar, %i errors\n", rounds, similar, errors);
+	return errors;
+}
+
+/*
+ * counts the titles that search() has to return for the prepared pattern
+ * by checking every title
+ */
+static uint32_t searchRef(const char *lopat) {
+	mptitle_t *root = getConfig()->root;
+	mptitle_t *title = root;
+	uint32_t num = 0;
+
+	do {
+		if (patMatchPrep(title->lotitle, lopat) ||
+			patMatchPrep(title->lodisplay, lopat)) {
+			num++;
+		}
+		title = title->next;
+	} while (title != root);
+
+	return num;
+}
+
+/*
+ * checks the titles that search() finds with the candidates from the
+ * trigram index and the cached searches against a check of all titles.
+ * The patterns are typed ahead character by character.
+ * returns the number of differences
+ */
+static int32_t searchTest(uint32_t rounds) {
+	mpconfig_t *config = getConfig();
+	mptitle_t *root = NULL;
+	mptitle_t *title;
+	char path[MAXPATHLEN + 1];
+	char artist[NAMELEN];
+	char name[NAMELEN];
+	char text[MAXPATHLEN + 1];
+	char pat[MAXPATHLEN + 1];
+	char lopat[MAXPATHLEN + 1];
+	char cursor[CURSORLEN];
+	uint32_t patterns = 0;
+	int32_t errors = 0;
+
+	for (uint32_t i = 1; i <= 2000; i++) {
+		title = (mptitle_t *) falloc(1, sizeof (mptitle_t));
+		/* few artists so that the texts are alike */
+		srandom(i % 50);
+		randomText(artist, 20);
+		srandom(rounds + i);
+		randomText(name, 40);
+		snprintf(path, MAXPATHLEN, "/music/%u.mp3", i);
+		internText(title, &title->path, path);
+		internTags(title, artist, name, "", "");
+		internTitle(title);
+		title->key = i;
+		if (root == NULL) {
+			title->next = title;
+			title->prev = title;
+			root = title;
+		}
+		else {
+			title->next = root;
+			title->prev = root->prev;
+			root->prev->next = title;
+			root->prev = title;
+		}
+	}
+	dbSetRoot(root);
+
+	for (uint32_t i = 0; i < rounds; i++) {
+		/* a part of some title as it may be typed */
+		title = getTitleByIndex(1 + random() % 2000);
+		strtcpy(text, title->display, MAXPATHLEN);
+		mutateText(text, MAXPATHLEN);
+		if (strlen(text) > 0) {
+			memmove(text, text + random() % strlen(text),
+					strlen(text) + 1);
+		}
+		text[MIN(strlen(text), 3 + (size_t) random() % 12)] = 0;
+
+		for (size_t len = 1; len <= strlen(text); len++) {
+			uint32_t got = 0;
+
+			strtcpy(pat, text, len + 1);
+			patPrep(lopat, pat, MAXPATHLEN);
+			if (strlen(lopat) == 0) {
+				continue;
+			}
+			cursor[0] = 0;
+			do {
+				search((mpcmd_t) (mpc_search | MPC_DFRANGE), pat,
+					   cursor[0] ? cursor : NULL, 0);
+				got += config->found->tnum;
+				strtcpy(cursor, config->found->cursor, CURSORLEN);
+			} while (cursor[0] != 0);
+
+			if (got != searchRef(lopat)) {
+				printf("search: '%s' found %u of %u\n", pat, got,
+					   searchRef(lopat));
+				errors++;
+			}
+			patterns++;
+		}
+	}
+
+	printf("%u patterns, %i errors\n", patterns, errors);
+	return errors;
+}
+
 int32_t main(int32_t argc, char **argv) {
+	char lotext1[MAXPATHLEN + 1];
+	char lotext2[MAXPATHLEN + 1];
 	int32_t res = 0;
 	mpconfig_t *config = readConfig();
 
 	config->debug = 9;
 
+	/* check the patMatch() kernels against each other */
+	if ((argc > 1) && (strcmp(argv[1], "-k") == 0)) {
+		return patKernelTest((argc > 2) ? atoi(argv[2]) : 100000);
+	}
+
+	/* check the search candidates against a check of all titles */
+	if ((argc > 1) && (strcmp(argv[1], "-s") == 0)) {
+		return searchTest((argc > 2) ? atoi(argv[2]) : 1000);
+	}
+
 	if (argc < 3) {
 		printf("Gib arguments!\n");
 		return 0;
@@ -47,10 +316,13 @@ int32_t main(int32_t argc, char **argv) {
 
 	res = patMatch(argv[1], argv[2]);
 	if (res) {
-		printf("%s and %s are similar\n", argv[1], argv[2]);
+		printf("%s and %s are similar", argv[1], argv[2]);
 	}
 	else {
-		printf("%s and %s are not similar\n", argv[1], argv[2]);
+		printf("%s and %s are not similar", argv[1], argv[2]);
 	}
+	patPrep(lotext1, argv[1], MAXPATHLEN);
+	patPrep(lotext2, argv[2], MAXPATHLEN);
+	printf(" (score %u%%)\n", patScore(lotext1, lotext2));
 	return res;
 }
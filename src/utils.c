@@ -13,6 +13,12 @@
 
 #include "utils.h"
 
+/* vector versions of the similarity check in patMatch() */
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PATSIMD 1
+#endif
+
 /**
  * checks if a character is a divisor
  * used in patPrep to remove 'fancy' characters before
@@ -45,13 +51,14 @@ static bool isdiv(const char c) {
  * 2. divisors are removed (-,.:;/)
  * 3. text is turned lowercase
  * 
+ * tgt must be able to hold len+1 characters
  * returns the length of the resulting string
  */
-static int patPrep(char *tgt, const char *src, int len) {
-	int tpos = 0;
+size_t patPrep(char *tgt, const char *src, size_t len) {
+	size_t tpos = 0;
 	bool sflag = false;
 
-	for (int pos = 0; (pos < len) && (src[pos] != '\0'); pos++) {
+	for (size_t pos = 0; (pos < len) && (src[pos] != '\0'); pos++) {
 		// reduce whitespaces
 		if (isspace(src[pos])) {
 			if (sflag)
@@ -85,57 +92,38 @@ static int patPrep(char *tgt, const char *src, int len) {
  * This should address most of the cases regarding search, artist and title comparison.
  */
 bool patMatch(const char *text1, const char *text2) {
-	char *lopat;
-	char *lotext;
-	size_t plen = 0;
-	size_t tlen = 0;
-
-	char lotext1[MAXPATHLEN+2];
-	char lotext2[MAXPATHLEN+2];
+	char lotext1[MAXPATHLEN+1];
+	char lotext2[MAXPATHLEN+1];
 
-	size_t t1len = patPrep(lotext1+1, text1, MAXPATHLEN);
-	size_t t2len = patPrep(lotext2+1, text2, MAXPATHLEN);
+	patPrep(lotext1, text1, MAXPATHLEN);
+	patPrep(lotext2, text2, MAXPATHLEN);
 
-	if (t1len < t2len) {
-		plen=t1len;
-		tlen=t2len;
-		lopat = lotext1;
-		lotext = lotext2+1;
-	}
-	else {
-		plen=t2len;
-		tlen=t1len;
-		lopat = lotext2;
-		lotext = lotext1+1;
-	}
-
-	
-	/* prepare the pattern */
-	lopat[0] = 0;
-	lopat[plen + 1] = 0;
-
-	/* The pattern is too short, so do a real substring test */
-	if (plen < 3) {
-		return (strstr(lopat+1, lotext) != NULL);
-	}
+	return patMatchPrep(lotext1, lotext2);
+}
 
-	int32_t best = 0;
-	int32_t res;
+/*
+ * returns the best number of matching characters of the pattern at any
+ * position in the text. This is the reference for the vector versions.
+ */
+static uint32_t patBestScalar(const char *lotext, size_t tlen,
+							  const char *lopat, size_t plen) {
+	uint32_t best = 0;
+	uint32_t res;
 
-	/* check */
 	for (size_t i = 0; i <= (tlen - plen); i++) {
 		res = 0;
 		for (size_t j = i; j < plen + i; j++) {
 			/* normal test */
-			if ((lotext[j] == lopat[j - i + 1])) {
+			if ((lotext[j] == lopat[j - i])) {
 				res++;
 			}
 			/* extended tests if applicable */
 			else if (plen > MATCHLEVEL) {
-				if (lotext[j] == lopat[j - i]) {
+				/* there is no character before the pattern */
+				if ((j > i) && (lotext[j] == lopat[j - i - 1])) {
 					res++;
 				} 
-				else if ((3*plen > 2*tlen) && (lotext[j] == lopat[j - i + 1])) {
+				else if ((3*plen > 2*tlen) && (lotext[j] == lopat[j - i])) {
 					res++;
 				}
 			}
@@ -146,13 +134,290 @@ bool patMatch(const char *text1, const char *text2) {
 		}
 	}
 
+	return best;
+}
+
+#ifdef PATSIMD
+/*
+ * The vector versions check 16 or 32 positions at once. Each pattern
+ * character is compared against the text at all positions and every hit
+ * counts up a byte counter per position. The off by +1 test is left out,
+ * it compares the same characters as the normal test and never hits.
+ * The text must be readable up to 31 bytes past its end and the pattern
+ * must not be longer than 255 characters so the counters do not overflow.
+ */
+__attribute__ ((target("sse2")))
+static uint32_t patBestSSE2(const char *lotext, size_t tlen,
+							const char *lopat, size_t plen) {
+	size_t num = tlen - plen + 1;
+	__m128i best = _mm_setzero_si128();
+	uint8_t counts[16];
+	uint32_t res = 0;
+
+	for (size_t i = 0; i < num; i += 16) {
+		__m128i count = _mm_setzero_si128();
+
+		for (size_t k = 0; k < plen; k++) {
+			__m128i text = _mm_loadu_si128((const __m128i *) (lotext + i + k));
+			__m128i hit = _mm_cmpeq_epi8(text, _mm_set1_epi8(lopat[k]));
+
+			if ((plen > MATCHLEVEL) && (k > 0)) {
+				__m128i prev = _mm_set1_epi8(lopat[k - 1]);
+
+				hit = _mm_or_si128(hit, _mm_cmpeq_epi8(text, prev));
+			}
+			/* a hit is -1 */
+			count = _mm_sub_epi8(count, hit);
+		}
+
+		if (i + 16 <= num) {
+			best = _mm_max_epu8(best, count);
+		}
+		else {
+			/* only some of the last positions are in the text */
+			_mm_storeu_si128((__m128i *) counts, count);
+			for (size_t j = 0; j < num - i; j++) {
+				res = MAX(res, counts[j]);
+			}
+		}
+	}
+
+	_mm_storeu_si128((__m128i *) counts, best);
+	for (size_t j = 0; j < 16; j++) {
+		res = MAX(res, counts[j]);
+	}
+	return res;
+}
+
+__attribute__ ((target("avx2")))
+static uint32_t patBestAVX2(const char *lotext, size_t tlen,
+							const char *lopat, size_t plen) {
+	size_t num = tlen - plen + 1;
+	__m256i best = _mm256_setzero_si256();
+	uint8_t counts[32];
+	uint32_t res = 0;
+
+	for (size_t i = 0; i < num; i += 32) {
+		__m256i count = _mm256_setzero_si256();
+
+		for (size_t k = 0; k < plen; k++) {
+			__m256i text =
+				_mm256_loadu_si256((const __m256i *) (lotext + i + k));
+			__m256i hit = _mm256_cmpeq_epi8(text, _mm256_set1_epi8(lopat[k]));
+
+			if ((plen > MATCHLEVEL) && (k > 0)) {
+				__m256i prev = _mm256_set1_epi8(lopat[k - 1]);
+
+				hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(text, prev));
+			}
+			/* a hit is -1 */
+			count = _mm256_sub_epi8(count, hit);
+		}
+
+		if (i + 32 <= num) {
+			best = _mm256_max_epu8(best, count);
+		}
+		else {
+			/* only some of the last positions are in the text */
+			_mm256_storeu_si256((__m256i *) counts, count);
+			for (size_t j = 0; j < num - i; j++) {
+				res = MAX(res, counts[j]);
+			}
+		}
+	}
+
+	_mm256_storeu_si256((__m256i *) counts, best);
+	for (size_t j = 0; j < 32; j++) {
+		res = MAX(res, counts[j]);
+	}
+	return res;
+}
+#endif
+
+/*
+ * returns true if the kernel can be used on this CPU
+ */
+bool patKernelAvailable(patkernel_t kernel) {
+	switch (kernel) {
+	case pat_auto:
+	case pat_scalar:
+		return true;
+#ifdef PATSIMD
+	case pat_sse2:
+		return __builtin_cpu_supports("sse2");
+	case pat_avx2:
+		return __builtin_cpu_supports("avx2");
+#endif
+	default:
+		return false;
+	}
+}
+
+/*
+ * runs the given kernel to find the best match of the pattern in the
+ * text. pat_auto picks the fastest one that the CPU supports, unavailable
+ * kernels fall back to the scalar version.
+ */
+static uint32_t patBest(const char *lotext, size_t tlen,
+						const char *lopat, size_t plen, patkernel_t kernel) {
+#ifdef PATSIMD
+	char text[MAXPATHLEN + 32];
+
+	if ((tlen > MAXPATHLEN) || (plen > UINT8_MAX)) {
+		return patBestScalar(lotext, tlen, lopat, plen);
+	}
+
+	if (kernel == pat_auto) {
+		kernel = patKernelAvailable(pat_avx2) ? pat_avx2 : pat_sse2;
+	}
+	if ((kernel == pat_scalar) || !patKernelAvailable(kernel)) {
+		return patBestScalar(lotext, tlen, lopat, plen);
+	}
+
+	/* the vector versions read over the end of the text */
+	memcpy(text, lotext, tlen);
+	memset(text + tlen, 0, sizeof (text) - tlen);
+
+	if (kernel == pat_avx2) {
+		return patBestAVX2(text, tlen, lopat, plen);
+	}
+	return patBestSSE2(text, tlen, lopat, plen);
+#else
+	(void) kernel;
+	return patBestScalar(lotext, tlen, lopat, plen);
+#endif
+}
+
+/*
+ * the shorter of two texts is the pattern that is looked for in the
+ * longer one
+ */
+static void patOrder(const char *lotext1, const char *lotext2,
+					 const char **lopat, size_t *plen,
+					 const char **lotext, size_t *tlen) {
+	size_t t1len = strlen(lotext1);
+	size_t t2len = strlen(lotext2);
+
+	if (t1len < t2len) {
+		*plen = t1len;
+		*tlen = t2len;
+		*lopat = lotext1;
+		*lotext = lotext2;
+	}
+	else {
+		*plen = t2len;
+		*tlen = t1len;
+		*lopat = lotext2;
+		*lotext = lotext1;
+	}
+}
+
+/*
+ * patMatch() for texts that already went through patPrep() with the given
+ * similarity kernel. This is mainly there to test the kernels against
+ * each other.
+ */
+bool patMatchKernel(const char *lotext1, const char *lotext2,
+					patkernel_t kernel) {
+	const char *lopat;
+	const char *lotext;
+	size_t plen = 0;
+	size_t tlen = 0;
+
+	patOrder(lotext1, lotext2, &lopat, &plen, &lotext, &tlen);
+
+	/* The pattern is too short, so do a real substring test */
+	if (plen < 3) {
+		return (strstr(lopat, lotext) != NULL);
+	}
+
 	/* compute percentual match */
-	res = (100 * best) / plen;
+	int32_t res = (100 * patBest(lotext, tlen, lopat, plen, kernel)) / plen;
 
 	/* if at least SIMGUARD% of characters match, we're going to allow it */
 	return (res >= SIMGUARD);
 }
 
+/*
+ * patMatch() for texts that already went through patPrep(). Used to
+ * compare titles with their stored search keys without preparing the same
+ * strings over and over again.
+ */
+bool patMatchPrep(const char *lotext1, const char *lotext2) {
+	return patMatchKernel(lotext1, lotext2, pat_auto);
+}
+
+/*
+ * returns the lowest number of edits that turn the pattern into any part
+ * of the text. This is Myers' bit-parallel algorithm, each bit holds the
+ * vertical delta of one pattern character, so the pattern must not be
+ * longer than 64 characters.
+ */
+static uint32_t patDistance(const char *lotext, size_t tlen,
+							const char *lopat, size_t plen) {
+	uint64_t peq[256];
+	uint64_t last = (uint64_t) 1 << (plen - 1);
+	uint64_t pv = ~(uint64_t) 0;
+	uint64_t mv = 0;
+	uint32_t dist = plen;
+	uint32_t best = plen;
+
+	memset(peq, 0, sizeof (peq));
+	for (size_t i = 0; i < plen; i++) {
+		peq[(uint8_t) lopat[i]] |= (uint64_t) 1 << i;
+	}
+
+	for (size_t j = 0; (j < tlen) && (best > 0); j++) {
+		uint64_t eq = peq[(uint8_t) lotext[j]];
+		uint64_t xv = eq | mv;
+		uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+		uint64_t ph = mv | ~(xh | pv);
+		uint64_t mh = pv & xh;
+
+		if (ph & last) {
+			dist++;
+		}
+		else if (mh & last) {
+			dist--;
+		}
+
+		/* the match may start anywhere in the text, so nothing is
+		 * shifted in at the top */
+		ph <<= 1;
+		mh <<= 1;
+		pv = mh | ~(xv | ph);
+		mv = ph & xv;
+		best = MIN(best, dist);
+	}
+
+	return best;
+}
+
+/*
+ * returns how well two prepared texts fit in percent. Like in patMatch()
+ * the shorter text is the pattern, the score is the share of its
+ * characters that are left after the fewest edits that are needed to find
+ * it in the longer text. Patterns with less than three characters need to
+ * be a real substring and longer ones than 64 characters are compared like
+ * in patMatch().
+ */
+uint32_t patScore(const char *lotext1, const char *lotext2) {
+	const char *lopat;
+	const char *lotext;
+	size_t plen = 0;
+	size_t tlen = 0;
+
+	patOrder(lotext1, lotext2, &lopat, &plen, &lotext, &tlen);
+
+	if (plen < 3) {
+		return (strstr(lopat, lotext) != NULL) ? 100 : 0;
+	}
+	if (plen > 64) {
+		return (100 * patBest(lotext, tlen, lopat, plen, pat_auto)) / plen;
+	}
+	return (100 * (plen - patDistance(lotext, tlen, lopat, plen))) / plen;
+}
+
 /*
  * like strncpy but len is the max len of the target string, not the number of
  * bytes to copy.
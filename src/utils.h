@@ -38,7 +38,20 @@ void fail(const int32_t error, const char *msg, ...)
 /**
  * General utility functions
  */
+size_t patPrep(char *tgt, const char *src, size_t len);
 bool patMatch(const char *text, const char *pat);
+bool patMatchPrep(const char *lotext, const char *lopat);
+
+/* implementations of the similarity check in patMatch() */
+typedef enum {
+	pat_auto,					/* the fastest one the CPU supports */
+	pat_scalar,
+	pat_sse2,
+	pat_avx2
+} patkernel_t;
+bool patKernelAvailable(patkernel_t kernel);
+bool patMatchKernel(const char *lotext, const char *lopat, patkernel_t kernel);
+uint32_t patScore(const char *lotext1, const char *lotext2);
 int32_t strltcpy(char *dest, const char *src, const size_t len);
 int32_t strltcat(char *dest, const char *src, const size_t len);
 char *strip(char *dest, const char *src, const size_t len);